@@ -0,0 +1,119 @@
+#define __cplusplus 201703L
+#include <climits>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <bluetooth/rfcomm.h>
+#include "adapter.h"
+
+namespace {
+    // Most connections we ask the kernel about per adapter. Anything beyond
+    // this counts as "very busy", which is all the selection policy needs.
+    constexpr int MAX_CONN {20};
+
+    // hci_for_each_dev() callback: append DEV_ID to the vector at ARG
+    int collect_dev_id(int dd, int dev_id, long arg)
+    {
+        ((std::vector<int> *) arg)->push_back(dev_id);
+        return 0; // keep going
+    }
+} // unnamed namespace
+
+std::vector<common::adapter_t> common::hci_adapter_source::adapters() const
+{
+    std::vector<int> dev_ids;
+    hci_for_each_dev(HCI_UP, collect_dev_id, (long) &dev_ids);
+
+    std::vector<adapter_t> result;
+    for (const int dev_id : dev_ids) {
+        struct hci_dev_info di {};
+        if (hci_devinfo(dev_id, &di) == -1)
+            continue;
+        result.push_back({dev_id, di.name, di.bdaddr});
+    }
+    return result;
+}
+
+int common::hci_adapter_source::load(const adapter_t& adapter) const
+{
+    const int sk = socket(AF_BLUETOOTH, SOCK_RAW, BTPROTO_HCI);
+    if (sk == -1)
+        return -1;
+
+    // Same request 'hcitool con' makes: a header followed by room for
+    // MAX_CONN entries, of which the kernel fills in conn_num
+    std::vector<uint8_t> buf(sizeof(hci_conn_list_req) + MAX_CONN * sizeof(hci_conn_info));
+    auto *cl {(hci_conn_list_req *) buf.data()};
+    cl->dev_id = adapter.dev_id;
+    cl->conn_num = MAX_CONN;
+    const int rc = ioctl(sk, HCIGETCONNLIST, cl);
+    close(sk);
+    return rc == -1 ? -1 : cl->conn_num;
+}
+
+// Set ADAPTER to the adapter in SOURCE called NAME.
+// Return 0 on success, or -1 if there is no such adapter.
+int common::find_adapter(const adapter_source& source, std::string_view name, adapter_t *adapter)
+{
+    for (const auto& a : source.adapters()) {
+        if (a.name == name) {
+            *adapter = a;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Set ADAPTER to the adapter in SOURCE with the fewest open connections,
+// preferring the first one listed on a tie. Adapters whose load cannot be
+// read are only picked when no other adapter is up.
+// Return 0 on success, or -1 if there are no adapters.
+int common::pick_adapter(const adapter_source& source, adapter_t *adapter)
+{
+    int best_load {INT_MAX};
+    int status {-1};
+    for (const auto& a : source.adapters()) {
+        int load {source.load(a)};
+        if (load < 0)
+            load = INT_MAX - 1;
+        if (load < best_load) {
+            best_load = load;
+            *adapter = a;
+            status = 0;
+        }
+    }
+    return status;
+}
+
+// Bind the RFCOMM socket SFD to the adapter in SOURCE called NAME, or to the
+// least loaded one if NAME is NULL, and set DEV_ID to its device number.
+// Return 0 on success, or -1 on error.
+int common::bind_adapter(int sfd, const adapter_source& source, const char *name, int *dev_id)
+{
+    adapter_t adapter {};
+    *dev_id = -1;
+    if (name != NULL) {
+        if (find_adapter(source, name, &adapter) != 0) {
+            fprintf(stderr, "No such adapter: %s\n", name);
+            return -1;
+        }
+    }
+    else if (pick_adapter(source, &adapter) != 0) {
+        return 0; // nothing listed; let the kernel route the connection
+    }
+
+    struct sockaddr_rc loc_addr {};
+    loc_addr.rc_family = AF_BLUETOOTH;
+    loc_addr.rc_bdaddr = adapter.bdaddr;
+    loc_addr.rc_channel = 0; // any free channel
+    if (bind(sfd, (struct sockaddr *) &loc_addr, sizeof(loc_addr)) == -1) {
+        perror("bind socket");
+        return -1;
+    }
+    *dev_id = adapter.dev_id;
+    return 0;
+}
@@ -0,0 +1,57 @@
+// adapter.h
+
+#ifndef ADAPTER_H
+#define ADAPTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+
+namespace common
+{
+    // A local bluetooth adapter (HCI controller)
+    struct adapter_t {
+        int dev_id;         // HCI device number, or -1 for "any adapter"
+        std::string name;   // e.g. "hci0"
+        bdaddr_t bdaddr;
+    };
+
+    // Where adapters and their current load come from. The selection policy
+    // below only talks to this interface, so it can be driven by fake
+    // adapters as well as by the real HCI stack.
+    class adapter_source {
+    public:
+        virtual ~adapter_source() = default;
+
+        // Return all adapters that are up
+        virtual std::vector<adapter_t> adapters() const = 0;
+
+        // Return the number of open connections on ADAPTER, or -1 if unknown
+        virtual int load(const adapter_t& adapter) const = 0;
+    };
+
+    // Adapters known to the local BlueZ stack
+    class hci_adapter_source : public adapter_source {
+    public:
+        std::vector<adapter_t> adapters() const override;
+        int load(const adapter_t& adapter) const override;
+    };
+
+    // Set ADAPTER to the adapter in SOURCE called NAME.
+    // Return 0 on success, or -1 if there is no such adapter.
+    int find_adapter(const adapter_source& source, std::string_view name, adapter_t *adapter);
+
+    // Set ADAPTER to the adapter in SOURCE with the fewest open connections,
+    // preferring the first one listed on a tie.
+    // Return 0 on success, or -1 if there are no adapters.
+    int pick_adapter(const adapter_source& source, adapter_t *adapter);
+
+    // Bind the RFCOMM socket SFD to the adapter in SOURCE called NAME, or to
+    // the least loaded one if NAME is NULL, and set DEV_ID to its device
+    // number. If NAME is NULL and no adapter is listed, SFD is left unbound
+    // and DEV_ID is set to -1. Return 0 on success, or -1 on error.
+    int bind_adapter(int sfd, const adapter_source& source, const char *name, int *dev_id);
+}
+
+#endif // ADAPTER_H
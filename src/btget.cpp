@@ -1,4 +1,5 @@
 #define __cplusplus 201703L
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -12,7 +13,9 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "adapter.h"
 #include "common.h"
+#include "tuner.h"
 
 namespace {
     // Everything inside this unnamed namespace has internal linkage.
@@ -27,24 +30,44 @@ namespace {
     struct options_t {
         uint8_t channel;
         const char *bdaddr;
-        const char *pathname;
+        vector<string> pathnames;
+        const char *adapter;    // local adapter name, or NULL to pick one
+        common::tuner_bounds bounds;
+        bool list;              // list the files the server has
+        const char *since;      // only files modified at or after this, or NULL
     };
 
     // https://www.gnu.org/software/libc/manual/html_node/Using-Getopt.html
     int parse_options(int argc, char *argv[], struct options_t *options)
     {
+        char *bvalue = NULL;
         char *cvalue = NULL;
+        char *ivalue = NULL;
+        char *svalue = NULL;
+        bool lflag = false;
         int c;
 
         opterr = 0; // don't print error message to stderr
 
-        while ((c = getopt(argc, argv, "c:")) != -1) {
+        while ((c = getopt(argc, argv, "b:c:i:ls:")) != -1) {
             switch (c) {
+            case 'b':
+                bvalue = optarg;
+                break;
             case 'c':
                 cvalue = optarg;
                 break;
+            case 'i':
+                ivalue = optarg;
+                break;
+            case 'l':
+                lflag = true;
+                break;
+            case 's':
+                svalue = optarg;
+                break;
             case '?':
-                if (optopt == 'c')
+                if (optopt == 'b' || optopt == 'c' || optopt == 'i' || optopt == 's')
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 else if (std::isprint(optopt))
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -56,89 +79,282 @@ namespace {
             }
         }
 
-        const int num_mandatory_args = 2;
-        if (optind + num_mandatory_args != argc) {
-            cerr << "Usage: btget [OPTION] BDADDR PATHNAME" << endl;
-            cerr << "Get PATHNAME from BDADDR." << endl;
+        // Listing, or getting everything modified since SINCE, takes only
+        // BDADDR. Otherwise at least one PATHNAME is needed.
+        const int num_args = argc - optind;
+        if (num_args < 1 || (lflag || svalue ? num_args != 1 : num_args < 2)) {
+            cerr << "Usage: btget [OPTION] BDADDR PATHNAME..." << endl;
+            cerr << "       btget [OPTION] -l [-s SINCE] BDADDR" << endl;
+            cerr << "       btget [OPTION] -s SINCE BDADDR" << endl;
+            cerr << "Get PATHNAMEs from BDADDR, list the files BDADDR serves, or get all of" << endl;
+            cerr << "them modified at or after SINCE (seconds since the epoch). Pass the" << endl;
+            cerr << "date the server printed with one listing as SINCE for the next." << endl;
             return 1;
         }
 
         // Set default options
         options->channel = common::DEFAULT_RFCOMM_CHANNEL;
         options->bdaddr = NULL;
-        options->pathname = NULL;
+        options->adapter = NULL;
+        options->bounds = common::DEFAULT_TUNER_BOUNDS;
+        options->list = false;
+        options->since = NULL;
 
         // Override default options with user-specified ones
         if (cvalue != NULL)
             options->channel = std::stoi(cvalue);
+        if (bvalue != NULL && common::parse_tuner_bounds(bvalue, &options->bounds) != 0) {
+            fprintf(stderr, "Invalid chunk size bounds `%s', expected MIN:MAX.\n", bvalue);
+            return 1;
+        }
+        options->adapter = ivalue;
+        options->list = lflag;
+        options->since = svalue;
         options->bdaddr = argv[optind];
-        options->pathname = argv[optind + 1];
+        options->pathnames.assign(argv + optind + 1, argv + argc);
 
         return 0;
     }
 
-    // Read from SFD and write to PATHNAME. Return 0 on success, or -1 on error.
-    int get_file(int sfd, std::string_view pathname)
+    // Read and parse response headers from SFD into MAP.
+    // Return 0 on success, or -1 on error.
+    int read_response(int sfd, std::map<string, string> *map)
     {
-        // Write request headers
-        char headers[512] {};
-        snprintf(headers, sizeof(headers), "method:GET\npathname:%s\n\n", pathname.data());
-        if (common::write_bytes(sfd, headers, strlen(headers)) != 0) {
-            perror("\nwrite socket");
-            return -1;
-        }
-
-        // Read and parse response headers sent by server
         const auto& res_headers {common::read_headers(sfd)};
         if (res_headers.size() == 0) {
             cerr << "read_headers error" << endl;
             return -1;
         }
-        const auto& map {common::parse_headers(res_headers)};
-        if (map.empty()) {
+        *map = common::parse_headers(res_headers);
+        if (map->empty()) {
             cerr << "parse_headers error" << endl;
             return -1;
         }
-        for (const auto& [k, v] : map) {
+        for (const auto& [k, v] : *map) {
             cout << "  " << k << ':' << v << endl;
         }
+        return 0;
+    }
+
+    // Read exactly FILESIZE bytes from the socket behind TUNER and write them
+    // to a file named after PATHNAME in "transfer". Return 0 on success, or -1 on error.
+    int receive_file(common::tuner& tuner, std::string_view pathname, ssize_t filesize)
+    {
+        // Open disk file for writing
+        const std::filesystem::path dir {"transfer"}, file {pathname};
+        std::ofstream fout {dir / file.filename(), std::ios::out | std::ios::binary};
+        if (!fout.is_open()) {
+            cerr << "open file failed" << endl;
+            return -1;
+        }
+
+        // Read data from server and write to file. Never read past the end
+        // of this file, as the next one may follow on the same socket.
+        ssize_t bytes_read {};
+        ssize_t bytes_done {};
+        vector<char> buf(tuner.max_chunk());
+        while (bytes_done < filesize
+            && (bytes_read = tuner.read(buf.data(), filesize - bytes_done)) > 0) {
+            fout.write(buf.data(), bytes_read);
+            bytes_done += bytes_read;
+            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
+        }
+        cerr << endl;
+
+        // Cleanup
+        fout.close();
+        return bytes_done == filesize ? 0 : -1;
+    }
+
+    // Read from SFD and write to PATHNAME. Chunk sizes are tuned within BOUNDS.
+    // If the server turns us away for now, RETRY_AFTER is set to the number of
+    // seconds it asked us to wait. Return 0 on success, or -1 on error.
+    int get_file(int sfd, std::string_view pathname, common::tuner_bounds bounds,
+        int *retry_after)
+    {
+        *retry_after = 0;
+
+        // Write request headers
+        char headers[512] {};
+        snprintf(headers, sizeof(headers), "method:GET\npathname:%s\n\n", pathname.data());
+        if (common::write_bytes(sfd, headers, strlen(headers)) != 0) {
+            perror("\nwrite socket");
+            return -1;
+        }
+
+        // Read and parse response headers sent by server
+        std::map<string, string> map;
+        if (read_response(sfd, &map) != 0)
+            return -1;
 
         // Check for 200 status code and get file size
         ssize_t filesize {};
         try {
             const int status_code {std::stoi(map.at("status"))};
             if (status_code != 200) {
+                *retry_after = common::retry_after(map);
                 return -1;
             }
             filesize = std::stol(map.at("content-length"));
         }
-        catch (const std::out_of_range& ex) {
+        catch (const std::logic_error& ex) {
             return -1;
         }
 
-        // Open disk file for writing
-        const std::filesystem::path dir {"transfer"}, file {pathname};
-        std::ofstream fout {dir / file.filename(), std::ios::out | std::ios::binary};
-        if (!fout.is_open()) {
-            cerr << "open file failed" << endl;
+        common::tuner tuner {sfd, bounds};
+        return receive_file(tuner, pathname, filesize);
+    }
+
+    // Get all of PATHNAMES from SFD in a single request. Chunk sizes are
+    // tuned within BOUNDS across the whole batch. RETRY_AFTER is set as for
+    // get_file(). Return 0 if every file was received, or -1 otherwise.
+    int get_files(int sfd, const vector<string>& pathnames, common::tuner_bounds bounds,
+        int *retry_after)
+    {
+        *retry_after = 0;
+
+        // Write request headers, then the pathnames one per line as the body
+        string body;
+        for (const auto& p : pathnames)
+            body += p + '\n';
+        const string headers {"method:GET\ncontent-length:" + std::to_string(body.size()) + "\n\n"};
+        if (common::write_bytes(sfd, headers.data(), headers.size()) != 0
+            || common::write_bytes(sfd, body.data(), body.size()) != 0) {
+            perror("\nwrite socket");
             return -1;
         }
 
-        // Read data from server and write to file
-        ssize_t bytes_read;
-        ssize_t bytes_done {};
-        char buf[2 * 1024] {};
-        while ((bytes_read = read(sfd, buf, sizeof(buf))) > 0) {
-            fout.write(buf, bytes_read);
-            bytes_done += bytes_read;
-            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
+        // Read and parse response headers sent by server
+        std::map<string, string> map;
+        if (read_response(sfd, &map) != 0)
+            return -1;
+        size_t count {};
+        try {
+            if (std::stoi(map.at("status")) != 200) {
+                *retry_after = common::retry_after(map);
+                return -1;
+            }
+            count = std::stoul(map.at("count"));
+        }
+        catch (const std::logic_error& ex) {
+            return -1;
         }
-        cerr << endl;
 
-        // Cleanup
-        fout.close();
+        // Each file comes with its own header block, followed by its data if
+        // the server has it
+        common::tuner tuner {sfd, bounds};
+        int status {};
+        for (size_t i {}; i < count; i++) {
+            const auto& item {common::parse_headers(common::read_headers(sfd))};
+            try {
+                const string& pathname {item.at("pathname")};
+                const int status_code {std::stoi(item.at("status"))};
+                cout << pathname << ' ' << status_code << endl;
+                if (status_code != 200) {
+                    status = -1;
+                    continue;
+                }
+                const ssize_t filesize {std::stol(item.at("content-length"))};
+                if (receive_file(tuner, pathname, filesize) != 0)
+                    return -1;
+            }
+            catch (const std::logic_error& ex) {
+                cerr << "malformed response for file " << i + 1 << endl;
+                return -1;
+            }
+        }
+        return status;
+    }
+
+    // Ask SFD for its listing of files modified at or after SINCE, or of all files
+    // if SINCE is NULL. Print it, and append the pathnames to PATHNAMES.
+    // RETRY_AFTER is set as for get_file(). Return 0 on success, or -1 on error.
+    int list_files(int sfd, const char *since, vector<string> *pathnames, int *retry_after)
+    {
+        *retry_after = 0;
+
+        // Write request headers
+        string headers {"method:LIST\n"};
+        if (since != NULL)
+            headers += "if-modified-since:" + string {since} + '\n';
+        headers += '\n';
+        if (common::write_bytes(sfd, headers.data(), headers.size()) != 0) {
+            perror("\nwrite socket");
+            return -1;
+        }
+
+        // Read and parse response headers sent by server. An empty listing
+        // comes without a content-length.
+        std::map<string, string> map;
+        if (read_response(sfd, &map) != 0)
+            return -1;
+        size_t length {};
+        try {
+            if (std::stoi(map.at("status")) != 200) {
+                *retry_after = common::retry_after(map);
+                return -1;
+            }
+            const auto& it {map.find("content-length")};
+            if (it != map.end())
+                length = std::stoul(it->second);
+        }
+        catch (const std::logic_error& ex) {
+            return -1;
+        }
+
+        // Print the listing: pathname, size and mtime separated by tabs
+        string body(length, '\0');
+        if (common::read_bytes(sfd, body.data(), length) != 0) {
+            cerr << "read listing failed" << endl;
+            return -1;
+        }
+        cout << body;
+        for (size_t begin {}, end {}; begin < body.size(); begin = end + 1) {
+            end = std::min(body.find('\n', begin), body.size());
+            const string line {body.substr(begin, end - begin)};
+            if (!line.empty())
+                pathnames->push_back(line.substr(0, line.find('\t')));
+        }
         return 0;
     }
+
+    // Connect to the server named in OPTIONS. Return the socket, or -1 on error.
+    int connect_server(const struct options_t& options)
+    {
+        // Allocate a socket
+        const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+
+        // Connect from the requested local adapter, or the least loaded one
+        int dev_id {};
+        if (common::bind_adapter(sfd, common::hci_adapter_source {}, options.adapter, &dev_id) != 0) {
+            close(sfd);
+            return -1;
+        }
+
+        // Set the connection parameters (who to connect to)
+        struct sockaddr_rc rem_addr {};
+        rem_addr.rc_family = AF_BLUETOOTH;
+        rem_addr.rc_channel = options.channel;
+        if (str2ba(options.bdaddr, &rem_addr.rc_bdaddr) != 0) {
+            cerr << "invalid BDADDR" << endl;
+            close(sfd);
+            return -1;
+        }
+
+        // Connect to server
+        if (connect(sfd, (struct sockaddr *) &rem_addr, sizeof(rem_addr)) == -1) {
+            perror("connect failed");
+            close(sfd);
+            return -1;
+        }
+
+        // Print address and name of server
+        const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr, dev_id)};
+        printf("Connected to %s %s on channel %u\n",
+            options.bdaddr, bdname.c_str(), rem_addr.rc_channel);
+
+        return sfd;
+    }
 } // unnamed namespace
 
 int main(int argc, char *argv[])
@@ -147,36 +363,37 @@ int main(int argc, char *argv[])
     if (parse_options(argc, argv, &options) != 0)
         return EXIT_FAILURE;
 
-    // Allocate a socket
-    const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
-
-    // Set the connection parameters (who to connect to)
-    struct sockaddr_rc rem_addr {};
-    rem_addr.rc_family = AF_BLUETOOTH;
-    rem_addr.rc_channel = options.channel;
-    if (str2ba(options.bdaddr, &rem_addr.rc_bdaddr) != 0) {
-        cerr << "invalid BDADDR" << endl;
-        close(sfd);
-        return EXIT_FAILURE;
+    // The server answers one request per connection, so a sync of
+    // everything new takes two: one to list and one to get the batch. Each
+    // backs off on its own while the server is too busy to serve us.
+    vector<string> pathnames {options.pathnames};
+    if (options.list || pathnames.empty()) {
+        const int status {common::retry_busy([&](int *retry_after) {
+            const int sfd = connect_server(options);
+            if (sfd == -1)
+                return -1;
+            const int status {list_files(sfd, options.since, &pathnames, retry_after)};
+            close(sfd);
+            return status;
+        })};
+        if (status != 0)
+            return EXIT_FAILURE;
+        if (options.list || pathnames.empty())
+            return EXIT_SUCCESS;
     }
 
-    // Connect to server
-    if (connect(sfd, (struct sockaddr *) &rem_addr, sizeof(rem_addr)) == -1) {
-        perror("connect failed");
+    // Get files from server. A single file uses the plain request, which
+    // older servers understand too.
+    const int status {common::retry_busy([&](int *retry_after) {
+        const int sfd = connect_server(options);
+        if (sfd == -1)
+            return -1;
+        const int status {pathnames.size() == 1
+            ? get_file(sfd, pathnames[0], options.bounds, retry_after)
+            : get_files(sfd, pathnames, options.bounds, retry_after)};
         close(sfd);
-        return EXIT_FAILURE;
-    }
-
-    // Print address and name of server
-    const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr)};
-    printf("Connected to %s %s on channel %u\n",
-        options.bdaddr, bdname.c_str(), rem_addr.rc_channel);
-
-    // Get file from server
-    if (options.pathname != NULL) {
-        get_file(sfd, options.pathname);
-    }
+        return status;
+    })};
 
-    close(sfd);
-    return EXIT_SUCCESS;
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
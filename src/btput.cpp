@@ -11,7 +11,10 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "adapter.h"
 #include "common.h"
+#include "sha256.h"
+#include "tuner.h"
 
 namespace {
     // Everything inside this unnamed namespace has internal linkage.
@@ -27,23 +30,33 @@ namespace {
         uint8_t channel;
         const char *bdaddr;
         const char *pathname;
+        const char *adapter;    // local adapter name, or NULL to pick one
+        common::tuner_bounds bounds;
     };
 
     // https://www.gnu.org/software/libc/manual/html_node/Using-Getopt.html
     int parse_options(int argc, char *argv[], struct options_t *options)
     {
+        char *bvalue = NULL;
         char *cvalue = NULL;
+        char *ivalue = NULL;
         int c;
 
         opterr = 0; // don't print error message to stderr
 
-        while ((c = getopt(argc, argv, "c:")) != -1) {
+        while ((c = getopt(argc, argv, "b:c:i:")) != -1) {
             switch (c) {
+            case 'b':
+                bvalue = optarg;
+                break;
             case 'c':
                 cvalue = optarg;
                 break;
+            case 'i':
+                ivalue = optarg;
+                break;
             case '?':
-                if (optopt == 'c')
+                if (optopt == 'b' || optopt == 'c' || optopt == 'i')
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 else if (std::isprint(optopt))
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -66,19 +79,31 @@ namespace {
         options->channel = common::DEFAULT_RFCOMM_CHANNEL;
         options->bdaddr = NULL;
         options->pathname = NULL;
+        options->adapter = NULL;
+        options->bounds = common::DEFAULT_TUNER_BOUNDS;
 
         // Override default options with user-specified ones
         if (cvalue != NULL)
             options->channel = std::stoi(cvalue);
+        if (bvalue != NULL && common::parse_tuner_bounds(bvalue, &options->bounds) != 0) {
+            fprintf(stderr, "Invalid chunk size bounds `%s', expected MIN:MAX.\n", bvalue);
+            return 1;
+        }
+        options->adapter = ivalue;
         options->bdaddr = argv[optind];
         options->pathname = argv[optind + 1];
 
         return 0;
     }
 
-    // Read from PATHNAME and write to SFD. Return 0 on success, or -1 on error.
-    int put_file(int sfd, std::string_view pathname)
+    // Read from PATHNAME and write to SFD. Chunk sizes are tuned within BOUNDS.
+    // If the server turns us away for now, RETRY_AFTER is set to the number of
+    // seconds it asked us to wait. Return 0 on success, or -1 on error.
+    int put_file(int sfd, std::string_view pathname, common::tuner_bounds bounds,
+        int *retry_after)
     {
+        *retry_after = 0;
+
         // Open file and get file size
         const int fin = open(pathname.data(), O_RDONLY);
         if (fin == -1) {
@@ -93,10 +118,19 @@ namespace {
         }
         const ssize_t filesize {st.st_size};
 
+        // Hash the file so the server can skip content it already has
+        const auto& digest {common::sha256_file(pathname.data())};
+        if (digest.empty()) {
+            perror("hash file");
+            close(fin);
+            return -1;
+        }
+
         // Write request headers
         char headers[512] {};
-        snprintf(headers, sizeof(headers), "method:PUT\npathname:%s\ncontent-length:%ld\n\n",
-            pathname.data(), filesize);
+        snprintf(headers, sizeof(headers),
+            "method:PUT\npathname:%s\ncontent-length:%ld\ncontent-sha256:%s\n\n",
+            pathname.data(), filesize, digest.c_str());
         if (common::write_bytes(sfd, headers, strlen(headers)) != 0) {
             perror("\nwrite socket");
             close(fin);
@@ -120,23 +154,32 @@ namespace {
             cout << "  " << k << ':' << v << endl;
         }
 
-        // Check for 200 status code
+        // Check for 200 status code, or 208 if the server already has the content
         try {
             const int status_code {std::stoi(map.at("status"))};
+            if (status_code == 208) {
+                cout << "Server already has this content, nothing to send" << endl;
+                close(fin);
+                return 0;
+            }
             if (status_code != 200) {
+                *retry_after = common::retry_after(map);
+                close(fin);
                 return -1;
             }
         }
-        catch (const std::out_of_range& ex) {
+        catch (const std::logic_error& ex) {
+            close(fin);
             return -1;
         }
 
         // Read data from file and send to server
+        common::tuner tuner {sfd, bounds};
         ssize_t bytes_read;
         ssize_t bytes_done {};
-        uint8_t buf[16 * 1024] {};
-        while ((bytes_read = read(fin, buf, sizeof(buf))) > 0) {
-            if (common::write_bytes(sfd, buf, bytes_read) != 0) {
+        vector<uint8_t> buf(tuner.max_chunk());
+        while ((bytes_read = read(fin, buf.data(), tuner.chunk_size())) > 0) {
+            if (tuner.write(buf.data(), bytes_read) != 0) {
                 perror("\nwrite socket");
                 close(fin);
                 return -1;
@@ -149,6 +192,44 @@ namespace {
         close(fin);
         return 0;
     }
+
+    // Connect to the server named in OPTIONS. Return the socket, or -1 on error.
+    int connect_server(const struct options_t& options)
+    {
+        // Allocate a socket
+        const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+
+        // Connect from the requested local adapter, or the least loaded one
+        int dev_id {};
+        if (common::bind_adapter(sfd, common::hci_adapter_source {}, options.adapter, &dev_id) != 0) {
+            close(sfd);
+            return -1;
+        }
+
+        // Set the connection parameters (who to connect to)
+        struct sockaddr_rc rem_addr {};
+        rem_addr.rc_family = AF_BLUETOOTH;
+        rem_addr.rc_channel = options.channel;
+        if (str2ba(options.bdaddr, &rem_addr.rc_bdaddr) != 0) {
+            cerr << "invalid BDADDR" << endl;
+            close(sfd);
+            return -1;
+        }
+
+        // Connect to server
+        if (connect(sfd, (struct sockaddr *) &rem_addr, sizeof(rem_addr)) == -1) {
+            perror("connect failed");
+            close(sfd);
+            return -1;
+        }
+
+        // Print address and name of server
+        const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr, dev_id)};
+        printf("Connected to %s %s on channel %u\n",
+            options.bdaddr, bdname.c_str(), rem_addr.rc_channel);
+
+        return sfd;
+    }
 } // unnamed namespace
 
 int main(int argc, char *argv[])
@@ -157,36 +238,15 @@ int main(int argc, char *argv[])
     if (parse_options(argc, argv, &options) != 0)
         return EXIT_FAILURE;
 
-    // Allocate a socket
-    const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
-
-    // Set the connection parameters (who to connect to)
-    struct sockaddr_rc rem_addr {};
-    rem_addr.rc_family = AF_BLUETOOTH;
-    rem_addr.rc_channel = options.channel;
-    if (str2ba(options.bdaddr, &rem_addr.rc_bdaddr) != 0) {
-        cerr << "invalid BDADDR" << endl;
-        close(sfd);
-        return EXIT_FAILURE;
-    }
-
-    // Connect to server
-    if (connect(sfd, (struct sockaddr *) &rem_addr, sizeof(rem_addr)) == -1) {
-        perror("connect failed");
+    // Send file to server, backing off while it is too busy to take it
+    const int status {common::retry_busy([&](int *retry_after) {
+        const int sfd = connect_server(options);
+        if (sfd == -1)
+            return -1;
+        const int status {put_file(sfd, options.pathname, options.bounds, retry_after)};
         close(sfd);
-        return EXIT_FAILURE;
-    }
-
-    // Print address and name of server
-    const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr)};
-    printf("Connected to %s %s on channel %u\n",
-        options.bdaddr, bdname.c_str(), rem_addr.rc_channel);
-
-    // Send file to server
-    if (options.pathname != NULL) {
-        put_file(sfd, options.pathname);
-    }
+        return status;
+    })};
 
-    close(sfd);
-    return EXIT_SUCCESS;
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,11 +1,15 @@
 #define __cplusplus 201703L
+#include <algorithm>
+#include <iostream>
 #include <unistd.h>
 #include "common.h"
 
-// Get friendly name of remote bluetooth device
-std::string common::get_remote_bdname(const bdaddr_t *bdaddr)
+// Get friendly name of remote bluetooth device, asking through local adapter
+// DEV_ID, or through the first available adapter if DEV_ID is negative
+std::string common::get_remote_bdname(const bdaddr_t *bdaddr, int dev_id)
 {
-    const int dev_id = hci_get_route(NULL);
+    if (dev_id < 0)
+        dev_id = hci_get_route(NULL);
     const int dd = hci_open_dev(dev_id);
     char bdname[248] {};
     if (hci_read_remote_name(dd, bdaddr, sizeof(bdname), bdname, 0) < 0)
@@ -28,6 +32,18 @@ int common::write_bytes(int fd, const void *buf, ssize_t n)
     return 0;
 }
 
+// Read exactly N bytes from FD into BUF. Return 0 on success, or -1 on
+// error or if end of file comes first.
+int common::read_bytes(int fd, void *buf, ssize_t n)
+{
+    for (ssize_t total {}, actual {}; total < n; total += actual) {
+        actual = read(fd, (uint8_t *) buf + total, n - total);
+        if (actual < 1)
+            return -1;
+    }
+    return 0;
+}
+
 // Read header lines from FD and return them. Newlines are discarded.
 std::vector<std::string> common::read_headers(int fd)
 {
@@ -70,3 +86,45 @@ common::parse_headers(const std::vector<std::string>& headers)
     }
     return map;
 }
+
+// Return the seconds the response headers in MAP ask the client to wait
+// before trying again, or 0 if they do not ask it to try again at all.
+int common::retry_after(const std::map<std::string, std::string>& map)
+{
+    const auto& it {map.find("retry-after")};
+    if (it == map.end())
+        return 0;
+    try {
+        return std::max(1, std::stoi(it->second));
+    }
+    catch (const std::logic_error& ex) {
+        return 0;
+    }
+}
+
+// Call ATTEMPT until it succeeds, or fails without asking to be retried, or
+// has been tried MAX_ATTEMPTS times. ATTEMPT sets RETRY_AFTER when the
+// server turned it away for now. Wait at least that long between tries, and
+// longer each time. Return what the last call of ATTEMPT returned.
+int common::retry_busy(const std::function<int(int *retry_after)>& attempt)
+{
+    // How many times to try a request the server asks us to retry later,
+    // and the longest we back off between tries, in seconds
+    const int MAX_ATTEMPTS {6};
+    const int MAX_BACKOFF {60};
+
+    int status {-1};
+    int backoff {1};
+    for (int i {1}; i <= MAX_ATTEMPTS; i++) {
+        int retry_after {};
+        status = attempt(&retry_after);
+        if (status == 0 || retry_after == 0 || i == MAX_ATTEMPTS)
+            break;
+
+        const int delay {std::max(retry_after, backoff)};
+        std::cerr << "Server busy, retrying in " << delay << " seconds" << std::endl;
+        sleep(delay);
+        backoff = std::min(backoff * 2, MAX_BACKOFF);
+    }
+    return status;
+}
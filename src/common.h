@@ -3,6 +3,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -15,10 +16,13 @@ namespace common
 {
     inline constexpr uint8_t DEFAULT_RFCOMM_CHANNEL {22};
 
-    std::string get_remote_bdname(const bdaddr_t *bdaddr);
+    std::string get_remote_bdname(const bdaddr_t *bdaddr, int dev_id = -1);
     int write_bytes(int fd, const void *buf, ssize_t n);
+    int read_bytes(int fd, void *buf, ssize_t n);
     std::vector<std::string> read_headers(int fd);
     std::map<std::string, std::string> parse_headers(const std::vector<std::string>& headers);
+    int retry_after(const std::map<std::string, std::string>& map);
+    int retry_busy(const std::function<int(int *retry_after)>& attempt);
 }
 
 #endif // COMMON_H
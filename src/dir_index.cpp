@@ -0,0 +1,142 @@
+#define __cplusplus 201703L
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dir_index.h"
+
+namespace {
+    // How far in the past a directory's mtime must be before it can be
+    // trusted to change with the next change to the directory. Timestamps
+    // with nanoseconds are at worst a few clock ticks apart; timestamps
+    // without come from filesystems that keep whole seconds, or even two.
+    constexpr int64_t FINE_TICK_NS {50'000'000};
+    constexpr int64_t COARSE_TICK_NS {2'000'000'000};
+
+    int64_t to_ns(const struct timespec& ts)
+    {
+        return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+    }
+
+    // Return the current time in seconds, from the clock that file
+    // timestamps are taken from
+    int64_t now_seconds()
+    {
+        struct timespec now {};
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        return now.tv_sec;
+    }
+} // unnamed namespace
+
+common::dir_index::dir_index(std::string dir)
+    : dir_ {std::move(dir)}, dir_mtime_ {}
+{
+}
+
+// Restat NAME after it was written or linked, or drop it if it is gone.
+void common::dir_index::update(const std::string& name)
+{
+    std::lock_guard lock {mutex_};
+    const auto& it {entries_.find(name)};
+    if (it != entries_.end())
+        erase(it);
+    insert(name, now_seconds());
+}
+
+// Return all entries modified at or after SINCE, oldest first, and set DATE
+// to the time of the listing if it is not NULL.
+std::vector<common::dir_entry> common::dir_index::list(int64_t since, int64_t *date)
+{
+    // Timestamps are whole seconds, so a name can change within the second
+    // of the listing yet after it. Such a name is listed again for SINCE =
+    // DATE rather than never. The date is taken before the directory is
+    // read, and under the lock that update() takes too.
+    std::lock_guard lock {mutex_};
+    if (date != NULL)
+        *date = now_seconds();
+    refresh();
+
+    std::vector<dir_entry> result;
+    for (auto it {by_mtime_.lower_bound(since)}; it != by_mtime_.end(); ++it)
+        result.push_back(entries_.at(it->second));
+    return result;
+}
+
+// Reread the directory if its mtime changed since the last time. Must be
+// called with mutex_ held.
+void common::dir_index::refresh()
+{
+    // Take the mtime before reading, so a change made while we read is
+    // picked up next time rather than lost
+    struct stat st {};
+    if (stat(dir_.c_str(), &st) == -1)
+        return;
+    if (st.st_mtim.tv_sec == dir_mtime_.tv_sec && st.st_mtim.tv_nsec == dir_mtime_.tv_nsec)
+        return;
+
+    // Timestamps are coarse, so a change in the same tick as this read would
+    // leave the mtime as it is. Until the mtime is safely in the past, read
+    // again every time.
+    struct timespec now {};
+    clock_gettime(CLOCK_REALTIME, &now);
+    const int64_t tick {st.st_mtim.tv_nsec != 0 ? FINE_TICK_NS : COARSE_TICK_NS};
+    if (to_ns(now) - to_ns(st.st_mtim) > tick)
+        dir_mtime_ = st.st_mtim;
+    else
+        dir_mtime_ = {};
+
+    DIR *dp = opendir(dir_.c_str());
+    if (dp == NULL)
+        return;
+
+    // Names whose inode is unchanged are still the same file; anything new
+    // or replaced is statted, and anything not seen is dropped
+    std::map<std::string, dir_entry> old;
+    old.swap(entries_);
+    by_mtime_.clear();
+    while (const dirent *de = readdir(dp)) {
+        const std::string name {de->d_name};
+        if (name[0] == '.')
+            continue;
+        const auto& it {old.find(name)};
+        if (it != old.end() && it->second.ino == de->d_ino) {
+            by_mtime_.emplace(it->second.mtime, name);
+            entries_.insert(old.extract(it));
+        }
+        else {
+            insert(name);
+        }
+    }
+    closedir(dp);
+}
+
+void common::dir_index::erase(std::map<std::string, dir_entry>::iterator it)
+{
+    auto [first, last] {by_mtime_.equal_range(it->second.mtime)};
+    for (; first != last; ++first) {
+        if (first->second == it->first) {
+            by_mtime_.erase(first);
+            break;
+        }
+    }
+    entries_.erase(it);
+}
+
+// Stat NAME and add it if it is a regular file that can be listed. List it
+// by LINKED if given, or else by its mtime.
+void common::dir_index::insert(const std::string& name, std::optional<int64_t> linked)
+{
+    // Names are sent one per line with tab separated fields
+    if (name.empty() || name[0] == '.' || name.find_first_of("\t\n") != std::string::npos)
+        return;
+
+    struct stat st {};
+    if (stat((dir_ + '/' + name).c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+        return;
+
+    // Deduplicated names are hard links to an older blob and share all of
+    // its timestamps, including the ctime that every new link moves on, so
+    // only the time a name was reported says when it got its contents
+    const int64_t mtime {linked.value_or(st.st_mtim.tv_sec)};
+    entries_[name] = {name, (uint64_t) st.st_size, mtime, st.st_ino};
+    by_mtime_.emplace(mtime, name);
+}
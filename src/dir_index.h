@@ -0,0 +1,57 @@
+// dir_index.h
+
+#ifndef DIR_INDEX_H
+#define DIR_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace common
+{
+    struct dir_entry {
+        std::string name;
+        uint64_t size;
+        int64_t mtime;      // when the name got its contents, in seconds since the epoch
+        ino_t ino;
+    };
+
+    // Index of the regular files in one directory, for answering listings
+    // without statting every file each time. It is kept up to date
+    // incrementally: the directory is only reread when its own mtime shows
+    // that entries were added, removed or renamed, and then only new or
+    // replaced names are statted. Files rewritten in place do not touch the
+    // directory, so writers must report them with update(). Names reported
+    // that way are listed by the time they were reported, and other names by
+    // their mtime. Hidden files are left out. Safe to use from several threads.
+    class dir_index {
+    public:
+        explicit dir_index(std::string dir);
+
+        // Restat NAME after it was written or linked, or drop it if it is gone
+        void update(const std::string& name);
+
+        // Return all entries modified at or after SINCE, oldest first. If
+        // DATE is not NULL, set it to the time of the listing: passing it
+        // back as SINCE lists everything that changes from now on.
+        std::vector<dir_entry> list(int64_t since, int64_t *date = NULL);
+
+    private:
+        void refresh();
+        void erase(std::map<std::string, dir_entry>::iterator it);
+        void insert(const std::string& name, std::optional<int64_t> linked = std::nullopt);
+
+        std::mutex mutex_;
+        const std::string dir_;
+        struct timespec dir_mtime_;
+        std::map<std::string, dir_entry> entries_;
+        std::multimap<int64_t, std::string> by_mtime_;
+    };
+}
+
+#endif // DIR_INDEX_H
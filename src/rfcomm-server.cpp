@@ -1,18 +1,20 @@
 #define __cplusplus 201703L
-#include <filesystem>
-#include <fstream>
+#include <atomic>
+#include <deque>
 #include <iostream>
-#include <map>
-#include <string>
-#include <string_view>
+#include <thread>
 #include <vector>
-#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
-#include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include "adapter.h"
 #include "common.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "tuner.h"
 
 namespace {
     // Everything inside this unnamed namespace has internal linkage.
@@ -21,30 +23,51 @@ namespace {
     using std::cout;
     using std::cerr;
     using std::endl;
-    using std::string;
     using std::vector;
 
-    struct options_t {
-        uint8_t channel;
+    // A listening socket on one local adapter, with its connection counters
+    struct listener_t {
+        int sfd;
+        common::adapter_t adapter;
+        std::atomic<unsigned long> accepted;
+        std::atomic<unsigned long> active;
+        std::atomic<unsigned long> failed;
     };
 
     // Parse command line arguments into OPTIONS. Return 0 on success, or -1 on error.
-    int parse_options(int argc, char *argv[], struct options_t *options)
+    int parse_options(int argc, char *argv[], common::server_options *options)
     {
+        char *bvalue = NULL;
         char *cvalue = NULL;
+        char *mvalue = NULL;
+        char *qvalue = NULL;
+        char *tvalue = NULL;
         int c;
 
         opterr = 0; // don't print error message to stderr
 
         // https://www.gnu.org/software/libc/manual/html_node/Using-Getopt.html
         // https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
-        while ((c = getopt(argc, argv, "c:")) != -1) {
+        while ((c = getopt(argc, argv, "b:c:m:q:t:")) != -1) {
             switch (c) {
+            case 'b':
+                bvalue = optarg;
+                break;
             case 'c':
                 cvalue = optarg;
                 break;
+            case 'm':
+                mvalue = optarg;
+                break;
+            case 'q':
+                qvalue = optarg;
+                break;
+            case 't':
+                tvalue = optarg;
+                break;
             case '?':
-                if (optopt == 'c')
+                if (optopt == 'b' || optopt == 'c' || optopt == 'm' || optopt == 'q'
+                    || optopt == 't')
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 else if (std::isprint(optopt))
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -58,207 +81,180 @@ namespace {
 
         // Set default options
         options->channel = common::DEFAULT_RFCOMM_CHANNEL;
+        options->bounds = common::DEFAULT_TUNER_BOUNDS;
+        options->max_file = 0;
+        options->budget = 64 * 1024 * 1024;
+        options->threads = 0;
 
         // Override default options with user-specified ones
         if (cvalue != NULL)
             options->channel = std::stoi(cvalue);
+        if (mvalue != NULL)
+            options->max_file = std::stoul(mvalue);
+        if (qvalue != NULL)
+            options->budget = std::stoul(qvalue);
+        if (tvalue != NULL)
+            options->threads = std::stoul(tvalue);
+        if (bvalue != NULL && common::parse_tuner_bounds(bvalue, &options->bounds) != 0) {
+            fprintf(stderr, "Invalid chunk size bounds `%s', expected MIN:MAX.\n", bvalue);
+            return -1;
+        }
 
         return 0;
     }
 
-    // Write response headers to CFD. Return 0 on success, or -1 on error.
-    int write_res_headers(int cfd, int status_code, ssize_t filesize = 0)
+    // Tell the client on CFD to come back later, then close CFD. Its request
+    // headers are read first: closing a socket with unread data resets the
+    // connection, and the client might never see the answer. A client that
+    // sends nothing for a second is not waited for.
+    void reject_client(int cfd)
     {
-        char headers[128] {};
-
-        if (filesize > 0) {
-            snprintf(headers, sizeof(headers), "status:%d\ncontent-length:%ld\n\n",
-                status_code, filesize);
-        }
-        else {
-            snprintf(headers, sizeof(headers), "status:%d\n\n", status_code);
-        }
-
-        if (common::write_bytes(cfd, headers, strlen(headers)) != 0) {
-            perror("\nwrite socket");
-            return -1;
-        }
-        return 0;
+        const timeval timeout {1, 0};
+        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        common::read_headers(cfd);
+        common::write_res_headers(cfd, 503, 0, common::RETRY_AFTER); // 503 Service Unavailable
+        close(cfd);
     }
 
-    // Read data from CFD and write to PATHNAME. Return 0 on success, or -1 on error.
-    int put_file(int cfd, std::string_view pathname, size_t filesize)
+    // Print the connection counters of listener L.
+    void print_stats(const listener_t& l)
     {
-        // Open disk file for writing
-        std::ofstream ofs {pathname.data(), std::ios::out | std::ios::binary};
-        if (!ofs.is_open()) {
-            cerr << "open file failed" << endl;
-            write_res_headers(cfd, 500);
-            return -1;
-        }
-
-        // Write response headers
-        if (write_res_headers(cfd, 200) == -1) {
-            ofs.close();
-            return -1;
-        }
-
-        // Read data from client and write to file
-        ssize_t bytes_read;
-        ssize_t bytes_done {};
-        char buf[2 * 1024] {};
-        while ((bytes_read = read(cfd, buf, sizeof(buf))) > 0) {
-            ofs.write(buf, bytes_read);
-            bytes_done += bytes_read;
-            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
-        }
-        cerr << endl;
-
-        // Cleanup
-        ofs.close();
-        return 0;
+        printf("%s: %lu accepted, %lu active, %lu failed\n", l.adapter.name.c_str(),
+            l.accepted.load(), l.active.load(), l.failed.load());
     }
 
-    // Read data from PATHNAME and write to CFD. Return 0 on success, or -1 on error.
-    int get_file(int cfd, std::string_view pathname)
+    // Wait for a client to connect on any of LISTENERS and serve it on a
+    // thread of its own. A connection never has more than one job queued on
+    // DISK, so serving at most one client per disk thread keeps one stalled
+    // disk operation from queueing ahead of another client's. Clients over
+    // that limit are told to come back later, on a thread of their own so a
+    // client that is slow to send its request cannot hold up the next
+    // accept(). Return 0 on success, or -1 on error.
+    int wait_client(std::deque<listener_t>& listeners, const common::server_options& options,
+        common::thread_pool& disk)
     {
-        // Open file and get file size
-        const int fin = open(pathname.data(), O_RDONLY);
-        if (fin == -1) {
-            perror("open file");
-            write_res_headers(cfd, 404);
-            return -1;
-        }
-        struct stat st {};
-        if (fstat(fin, &st) == -1 || st.st_size < 1 || !S_ISREG(st.st_mode)) {
-            cerr << "not a regular file: " << pathname << endl;
-            close(fin);
-            write_res_headers(cfd, 404);
+        cout << "Waiting for connection..." << endl;
+        vector<pollfd> fds;
+        for (const auto& l : listeners)
+            fds.push_back({l.sfd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            perror("poll");
             return -1;
         }
-        const ssize_t filesize {st.st_size};
 
-        // Write response headers
-        if (write_res_headers(cfd, 200, filesize) == -1) {
-            close(fin);
-            return -1;
-        }
+        for (size_t i {}; i < fds.size(); i++) {
+            if ((fds[i].revents & POLLIN) == 0)
+                continue;
 
-        // Read data from file and write to client
-        ssize_t bytes_read;
-        ssize_t bytes_done {};
-        uint8_t buf[16 * 1024] {};
-        while ((bytes_read = read(fin, buf, sizeof(buf))) > 0) {
-            if (common::write_bytes(cfd, buf, bytes_read) != 0) {
-                perror("\nwrite socket");
-                close(fin);
-                return -1;
+            listener_t& l {listeners[i]};
+            sockaddr_rc rem_addr {};
+            socklen_t opt {sizeof(rem_addr)};
+            const int cfd = accept(l.sfd, (sockaddr *) &rem_addr, &opt);
+            if (cfd == -1) {
+                perror("accept");
+                continue;
             }
-            bytes_done += bytes_read;
-            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
-        }
-        cerr << endl;
 
-        close(fin);
+            l.accepted++;
+            unsigned long active {};
+            for (const auto& other : listeners)
+                active += other.active;
+            if (active >= disk.size()) {
+                cerr << "rejected: serving " << active << " clients already" << endl;
+                std::thread {reject_client, cfd}.detach();
+                l.failed++;
+                continue;
+            }
+
+            l.active++;
+            std::thread {[cfd, rem_addr, &l, &options, &disk] {
+                if (common::serve_client(cfd, rem_addr, l.adapter.dev_id, options, disk) != 0)
+                    l.failed++;
+                l.active--;
+                print_stats(l);
+            }}.detach();
+        }
         return 0;
     }
 
-    int wait_client(int sfd)
+    // Return a socket listening on CHANNEL of the local adapter with address
+    // BDADDR, or -1 on error.
+    int listen_adapter(const bdaddr_t& bdaddr, uint8_t channel)
     {
-        // Wait for a client to connect
-        cout << "Waiting for connection..." << endl;
-        sockaddr_rc rem_addr {};
-        socklen_t opt {sizeof(rem_addr)};
-        const int cfd = accept(sfd, (sockaddr *) &rem_addr, &opt);
-
-        // Print address and name of remote bluetooth device
-        char bdaddr[18] {};
-        ba2str(&rem_addr.rc_bdaddr, bdaddr);
-        const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr)};
-        printf("Accepted connection from %s %s\n", bdaddr, bdname.c_str());
-
-        // Read and parse headers sent by client
-        const auto& headers {common::read_headers(cfd)};
-        if (headers.size() == 0) {
-            cerr << "read_headers error" << endl;
-            close(cfd);
+        // Allocate a socket
+        const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+        if (sfd == -1) {
+            perror("create socket");
             return -1;
         }
-        const auto& map {common::parse_headers(headers)};
-        if (map.empty()) {
-            cerr << "parse_headers error" << endl;
-            close(cfd);
+
+        // Bind socket to the local bluetooth adapter
+        struct sockaddr_rc loc_addr {};
+        loc_addr.rc_family = AF_BLUETOOTH;
+        loc_addr.rc_bdaddr = bdaddr;
+        loc_addr.rc_channel = channel;
+        if (bind(sfd, (struct sockaddr *) &loc_addr, sizeof(loc_addr)) == -1) {
+            perror("bind socket");
+            close(sfd);
             return -1;
         }
-        for (const auto& [k, v] : map) {
-            cout << "  " << k << ':' << v << endl;
-        }
 
-        int status {-1};
-        try {
-            // Call either put_file() or get_file(), depending on the "method" header
-            const std::string_view method {map.at("method")};
-            if (method == "PUT") {
-                namespace fs = std::filesystem;
-                const fs::path p {map.at("pathname")};
-                const fs::path dir {"transfer"};
-                const fs::path pathname {dir / p.filename()};
-                const size_t filesize {std::stoul(map.at("content-length"))};
-                status = put_file(cfd, pathname.string(), filesize);
-            }
-            else if (method == "GET") {
-                const std::string_view pathname {map.at("pathname")};
-                status = get_file(cfd, pathname);
-            }
-            else {
-                cerr << "invalid method: " << method << endl;
-            }
-        }
-        catch (const std::out_of_range& ex) {
-            cerr << "out of range exception: " << ex.what() << endl;
+        // Put socket into listening mode
+        if (listen(sfd, 1) == -1) {
+            perror("socket listen");
+            close(sfd);
+            return -1;
         }
-
-        // Cleanup
-        close(cfd);
-        return status;
+        return sfd;
     }
 } // unnamed namespace
 
 int main(int argc, char *argv[])
 {
-    struct options_t options {};
+    common::server_options options {};
     if (parse_options(argc, argv, &options) != 0)
         return EXIT_FAILURE;
 
-    // Allocate a socket
-    const int sfd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
-    if (sfd == -1) {
-        perror("create socket");
+    // Make sure the content-addressed store exists
+    if (common::init_store() != 0)
         return EXIT_FAILURE;
-    }
 
-    // Bind socket to the first available local bluetooth adapter
-    const bdaddr_t BDADDR_ANY_INITIALIZER {};
-    struct sockaddr_rc loc_addr {};
-    loc_addr.rc_family = AF_BLUETOOTH;
-    loc_addr.rc_bdaddr = BDADDR_ANY_INITIALIZER;
-    loc_addr.rc_channel = options.channel;
-    if (bind(sfd, (struct sockaddr *) &loc_addr, sizeof(loc_addr)) == -1) {
-        perror("bind socket");
-        return EXIT_FAILURE;
+    // Listen on every local adapter, so clients can spread their load
+    // across controllers. If none can be listed, let the kernel pick one.
+    const common::hci_adapter_source source;
+    auto adapters {source.adapters()};
+    if (adapters.empty()) {
+        const bdaddr_t BDADDR_ANY_INITIALIZER {};
+        adapters.push_back({-1, "any", BDADDR_ANY_INITIALIZER});
     }
+    std::deque<listener_t> listeners;
+    for (const auto& a : adapters) {
+        const int sfd = listen_adapter(a.bdaddr, options.channel);
+        if (sfd == -1)
+            continue;
+        listeners.emplace_back();
+        listeners.back().sfd = sfd;
+        listeners.back().adapter = a;
 
-    // Put socket into listening mode
-    if (listen(sfd, 1) == -1) {
-        perror("socket listen");
-        return EXIT_FAILURE;
+        char bdaddr[18] {};
+        ba2str(&a.bdaddr, bdaddr);
+        cout << "Listening on " << a.name << ' ' << bdaddr
+            << " channel " << +options.channel << endl;
     }
-    cout << "Listening on channel " << +loc_addr.rc_channel << endl;
+    if (listeners.empty())
+        return EXIT_FAILURE;
+
+    // Filesystem work is done on a pool so that a slow disk only ever holds
+    // up the connection that is waiting for it. The pool size also caps the
+    // number of clients served at once.
+    common::thread_pool disk {options.threads};
+    cout << "Serving up to " << disk.size() << " clients at once" << endl;
 
     while (true) {
-        wait_client(sfd);
+        wait_client(listeners, options, disk);
     }
 
-    close(sfd);
+    for (const auto& l : listeners)
+        close(l.sfd);
     return EXIT_SUCCESS;
 }
@@ -3,6 +3,7 @@
  * in this format: <bdaddr> <device-class> <friendly-name>
  * Example: 11:22:33:44:55:AB 0x5A020C My Phone
  * The target device must first be set to discoverable mode.
+ * Use -i hciN to scan with a particular local adapter.
  * Device classes are defined in:
  * https://www.bluetooth.com/specifications/assigned-numbers/baseband/
  */
@@ -17,7 +18,15 @@
 
 int main(int argc, char *argv[])
 {
-    const int dev_id = hci_get_route(NULL);
+    // Use the adapter given with -i, or else the first available one
+    int dev_id = hci_get_route(NULL);
+    int c;
+    while ((c = getopt(argc, argv, "i:")) != -1) {
+        if (c != 'i')
+            return EXIT_FAILURE;
+        dev_id = hci_devid(optarg);
+    }
+
     const int sock = hci_open_dev(dev_id);
     if (dev_id < 0 || sock < 0) {
         perror("opening socket");
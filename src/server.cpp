@@ -0,0 +1,600 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include "common.h"
+#include "dir_index.h"
+#include "server.h"
+#include "sha256.h"
+#include "thread_pool.h"
+#include "tuner.h"
+
+namespace {
+    using std::cout;
+    using std::cerr;
+    using std::endl;
+    using std::string;
+    using std::vector;
+    namespace fs = std::filesystem;
+
+    // Content-addressed store for uploads. Every blob is named after the
+    // SHA-256 digest of its contents, so the directory itself is the index
+    // and survives restarts. Names in "transfer" are hard links to blobs.
+    const fs::path BLOB_DIR {"transfer/.blobs"};
+
+    // Listing of the files in "transfer", for LIST requests
+    common::dir_index transfer_index {"transfer"};
+
+    // Bytes of admitted uploads that are still being received
+    std::mutex in_flight_mutex;
+    size_t in_flight_bytes {};      // guarded by in_flight_mutex
+
+    // Held while names are linked to or unlinked from blobs, so garbage
+    // collection never sees a blob that is about to gain or lose a name
+    std::mutex store_mutex;
+
+    // Return true if DIGEST looks like a SHA-256 hex digest.
+    bool is_valid_digest(std::string_view digest)
+    {
+        return digest.size() == 64
+            && digest.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+    }
+
+    // Remove blobs that no name links to any more. With STARTUP, also remove
+    // temporary files of uploads that were cut short when the server died.
+    // Must be called with store_mutex held.
+    void collect_garbage(bool startup)
+    {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator {BLOB_DIR, ec}) {
+            const string name {entry.path().filename()};
+            struct stat st;
+            if (name.rfind("incoming.", 0) == 0) {
+                if (!startup)
+                    continue;
+            }
+            else if (lstat(entry.path().c_str(), &st) == -1 || !S_ISREG(st.st_mode)
+                || st.st_nlink != 1) {
+                continue;
+            }
+            if (unlink(entry.path().c_str()) == 0)
+                cout << "Removed " << entry.path().string() << endl;
+        }
+    }
+
+    // Remove PATHNAME, along with the blob it was the last name of.
+    // Must be called with store_mutex held.
+    void remove_name(const fs::path& pathname)
+    {
+        // Only a name with exactly one other link can have been the last
+        // name of a blob, so leave the store alone for anything else
+        struct stat st;
+        if (lstat(pathname.c_str(), &st) == -1 || unlink(pathname.c_str()) == -1)
+            return;
+        if (S_ISREG(st.st_mode) && st.st_nlink == 2)
+            collect_garbage(false);
+    }
+
+    // Link PATHNAME to the stored blob named DIGEST if that blob exists and
+    // is FILESIZE bytes long. Must be called with store_mutex held.
+    // Return 0 on success, or -1 on error.
+    int link_blob(const string& digest, size_t filesize, const fs::path& pathname)
+    {
+        const fs::path blob {BLOB_DIR / digest};
+        std::error_code ec;
+        const auto blobsize {fs::file_size(blob, ec)};
+        if (ec || blobsize != filesize)
+            return -1;
+
+        // Relinking a name to its own blob would collect the blob first
+        if (fs::equivalent(pathname, blob, ec))
+            return 0;
+        remove_name(pathname);
+        fs::create_hard_link(blob, pathname, ec);
+        if (ec) {
+            cerr << "link " << pathname << " failed: " << ec.message() << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // Read data from CFD and write to PATHNAME. Disk writes run on DISK while
+    // the next chunk is received. Chunk sizes are tuned within BOUNDS.
+    // Return 0 on success, or -1 on error.
+    int receive_file(int cfd, const fs::path& pathname, size_t filesize, const string& digest,
+        common::tuner_bounds bounds, common::thread_pool& disk)
+    {
+        // Unknown content is received into a temporary file in the blob store
+        // and only committed once its digest checks out. Clients that send no
+        // digest have their data written straight to PATHNAME. Never write
+        // through an existing name, as it may be a link to a shared blob.
+        string tmpname {(BLOB_DIR / "incoming.XXXXXX").string()};
+        const int fout {disk.submit([&] {
+            if (!digest.empty()) {
+                const int fd = mkstemp(tmpname.data());
+                if (fd != -1)
+                    fchmod(fd, 0644);
+                return fd;
+            }
+            std::lock_guard lock {store_mutex};
+            remove_name(pathname);
+            return open(pathname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }).get()};
+        if (fout == -1) {
+            cerr << "open file failed: " << pathname << endl;
+            common::write_res_headers(cfd, 500);
+            return -1;
+        }
+
+        // Write response headers
+        if (common::write_res_headers(cfd, 200) == -1) {
+            disk.submit([&] {
+                close(fout);
+                if (!digest.empty())
+                    unlink(tmpname.c_str());
+            }).wait();
+            return -1;
+        }
+
+        // Read data from client and write to file, hashing it on the way.
+        // Two buffers take turns: one is being filled from the socket while
+        // the other is being written out. Never take more than the client
+        // declared, as that is what admission control agreed to.
+        common::tuner tuner {cfd, bounds};
+        common::sha256 hash;
+        vector<uint8_t> bufs[2] {vector<uint8_t>(tuner.max_chunk()), vector<uint8_t>(tuner.max_chunk())};
+        std::future<int> pending;
+        int which {};
+        int status {};
+        ssize_t bytes_read;
+        size_t bytes_done {};
+        while (bytes_done < filesize
+            && (bytes_read = tuner.read(bufs[which].data(), filesize - bytes_done)) > 0) {
+            if (pending.valid() && pending.get() != 0) {
+                status = -1;
+                break;
+            }
+            pending = disk.submit([&, data = bufs[which].data(), n = bytes_read] {
+                if (common::write_bytes(fout, data, n) != 0) {
+                    perror("\nwrite file");
+                    return -1;
+                }
+                if (!digest.empty())
+                    hash.update(data, n);
+                return 0;
+            });
+            which ^= 1;
+            bytes_done += bytes_read;
+            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
+        }
+        cerr << endl;
+        if (pending.valid() && pending.get() != 0)
+            status = -1;
+
+        // The client must send exactly content-length bytes and then close
+        if (bytes_done != filesize) {
+            cerr << "client sent " << bytes_done << " of " << filesize << " bytes" << endl;
+            status = -1;
+        }
+        else if (char extra; read(cfd, &extra, 1) > 0) {
+            cerr << "client sent more than content-length" << endl;
+            status = -1;
+        }
+
+        // Cleanup. Only content that matches the advertised size and digest
+        // may enter the store, otherwise a bad client could poison later lookups.
+        return disk.submit([&] {
+            close(fout);
+            if (digest.empty()) {
+                if (status != 0)
+                    unlink(pathname.c_str());
+                return status;
+            }
+            if (status != 0 || hash.hexdigest() != digest) {
+                cerr << "upload is incomplete or does not match content-sha256, discarding" << endl;
+                unlink(tmpname.c_str());
+                return -1;
+            }
+
+            // Name the new blob before storing it, so it never sits in the
+            // store without a link for garbage collection to find
+            std::lock_guard lock {store_mutex};
+            if (link_blob(digest, filesize, pathname) == 0) {
+                // Another client stored the same content in the meantime
+                unlink(tmpname.c_str());
+                return 0;
+            }
+            remove_name(pathname);
+            if (link(tmpname.c_str(), pathname.c_str()) == -1) {
+                perror("link file");
+                unlink(tmpname.c_str());
+                return -1;
+            }
+            if (rename(tmpname.c_str(), (BLOB_DIR / digest).c_str()) == -1) {
+                perror("rename blob");
+                unlink(pathname.c_str());
+                unlink(tmpname.c_str());
+                return -1;
+            }
+            return 0;
+        }).get();
+    }
+
+    // Accept an upload of FILESIZE bytes from CFD into PATHNAME. If the client
+    // sent a DIGEST of content we already hold, link PATHNAME to it and tell
+    // the client not to send anything. Return 0 on success, or -1 on error.
+    int put_file(int cfd, const fs::path& pathname, size_t filesize, const string& digest,
+        const common::server_options& options, common::thread_pool& disk)
+    {
+        if (!digest.empty()
+            && disk.submit([&] {
+                std::lock_guard lock {store_mutex};
+                return link_blob(digest, filesize, pathname);
+            }).get() == 0) {
+            cout << "Content already stored as " << digest << endl;
+            disk.submit([&] { transfer_index.update(pathname.filename()); }).wait();
+            return common::write_res_headers(cfd, 208); // 208 Already Reported
+        }
+
+        if (common::admit_upload(cfd, filesize, options, disk) != 0)
+            return -1;
+
+        const int status {receive_file(cfd, pathname, filesize, digest, options.bounds, disk)};
+        disk.submit([&] { transfer_index.update(pathname.filename()); }).wait();
+        common::release_upload(filesize);
+        return status;
+    }
+
+    // Open PATHNAME for reading and fill in ST. Runs on DISK.
+    // Return the file descriptor, or -1 if it is not a non-empty regular file.
+    int open_file(std::string_view pathname, struct stat *st, common::thread_pool& disk)
+    {
+        return disk.submit([&] {
+            const int fd = open(pathname.data(), O_RDONLY);
+            if (fd == -1)
+                return -1;
+            if (fstat(fd, st) == -1 || st->st_size < 1 || !S_ISREG(st->st_mode)) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }).get();
+    }
+
+    // Send FILESIZE bytes from FIN to CFD, using TUNER for the socket side.
+    // Disk reads run on DISK, one chunk ahead of the socket. Does not close FIN.
+    // Return 0 on success, or -1 on error.
+    int send_file(int fin, ssize_t filesize, common::tuner& tuner, common::thread_pool& disk)
+    {
+        // Two buffers take turns: one is being sent while the next chunk is
+        // read into the other. Never read past FILESIZE, even if the file has
+        // grown since, as the next file may follow on the same socket.
+        vector<uint8_t> bufs[2] {vector<uint8_t>(tuner.max_chunk()), vector<uint8_t>(tuner.max_chunk())};
+        const auto read_chunk {[&](int which, ssize_t offset) {
+            const size_t n {std::min<size_t>(tuner.chunk_size(), filesize - offset)};
+            return disk.submit([&, data = bufs[which].data(), n] {
+                return read(fin, data, n);
+            });
+        }};
+        std::future<ssize_t> pending {read_chunk(0, 0)};
+        int which {};
+        ssize_t bytes_read;
+        ssize_t bytes_done {};
+        while ((bytes_read = pending.get()) > 0) {
+            pending = read_chunk(which ^ 1, bytes_done + bytes_read);
+            if (tuner.write(bufs[which].data(), bytes_read) != 0) {
+                perror("\nwrite socket");
+                pending.wait();
+                return -1;
+            }
+            which ^= 1;
+            bytes_done += bytes_read;
+            cerr << '\r' << bytes_done << ' ' << bytes_done * 100 / filesize << '%';
+        }
+        cerr << endl;
+
+        // The file may have shrunk since it was statted, and the client is
+        // counting on exactly FILESIZE bytes
+        return bytes_done == filesize ? 0 : -1;
+    }
+
+    // Read data from PATHNAME and write to CFD. Chunk sizes are tuned within
+    // BOUNDS. Return 0 on success, or -1 on error.
+    int get_file(int cfd, std::string_view pathname, common::tuner_bounds bounds,
+        common::thread_pool& disk)
+    {
+        // Open file and get file size
+        struct stat st {};
+        const int fin {open_file(pathname, &st, disk)};
+        if (fin == -1) {
+            cerr << "not a regular file: " << pathname << endl;
+            common::write_res_headers(cfd, 404);
+            return -1;
+        }
+        const ssize_t filesize {st.st_size};
+
+        // Write response headers
+        if (common::write_res_headers(cfd, 200, filesize) == -1) {
+            close(fin);
+            return -1;
+        }
+
+        // Read data from file and write to client
+        common::tuner tuner {cfd, bounds};
+        const int status {send_file(fin, filesize, tuner, disk)};
+        close(fin);
+        return status;
+    }
+
+    // Read a request body of LENGTH bytes from CFD listing one pathname per
+    // line, and send all of those files back in one response. After the
+    // response headers, each file gets its own header block, with
+    // content-length and data only if it was found. Chunk sizes are tuned
+    // within BOUNDS across the whole batch. Return 0 on success, or -1 on error.
+    int get_files(int cfd, size_t length, common::tuner_bounds bounds, common::thread_pool& disk)
+    {
+        const size_t max_length {4 * 1024 * 1024}; // safeguard against malformed input
+        if (length > max_length) {
+            common::write_res_headers(cfd, 413);
+            return -1;
+        }
+        string body(length, '\0');
+        if (common::read_bytes(cfd, body.data(), length) != 0) {
+            cerr << "read request body failed" << endl;
+            return -1;
+        }
+        vector<string> pathnames;
+        for (size_t begin {}, end {}; begin < body.size(); begin = end + 1) {
+            end = std::min(body.find('\n', begin), body.size());
+            if (end > begin)
+                pathnames.push_back(body.substr(begin, end - begin));
+        }
+
+        // Write response headers
+        const string headers {"status:200\ncount:" + std::to_string(pathnames.size()) + "\n\n"};
+        if (common::write_bytes(cfd, headers.data(), headers.size()) != 0) {
+            perror("\nwrite socket");
+            return -1;
+        }
+
+        common::tuner tuner {cfd, bounds};
+        for (const auto& pathname : pathnames) {
+            struct stat st {};
+            const int fin {open_file(pathname, &st, disk)};
+            string item {"pathname:" + pathname + '\n'};
+            if (fin == -1)
+                item += "status:404\n\n";
+            else
+                item += "status:200\ncontent-length:" + std::to_string(st.st_size) + "\n\n";
+            if (common::write_bytes(cfd, item.data(), item.size()) != 0) {
+                perror("\nwrite socket");
+                if (fin != -1)
+                    close(fin);
+                return -1;
+            }
+            if (fin == -1)
+                continue;
+
+            // A short file would leave the client out of step with the
+            // stream, so give up on the whole batch
+            const int status {send_file(fin, st.st_size, tuner, disk)};
+            close(fin);
+            if (status != 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    // Send the listing of the transfer directory to CFD, leaving out files
+    // modified before SINCE. Each line holds a pathname that can be passed
+    // to GET, its size and its mtime in seconds since the epoch, separated
+    // by tabs. The date header holds the time of the listing, for the client
+    // to send back as if-modified-since next time.
+    // Return 0 on success, or -1 on error.
+    int list_files(int cfd, int64_t since, common::thread_pool& disk)
+    {
+        int64_t date {};
+        const auto& entries {disk.submit([since, &date] {
+            return transfer_index.list(since, &date);
+        }).get()};
+        string body;
+        for (const auto& e : entries) {
+            body += "transfer/" + e.name + '\t' + std::to_string(e.size)
+                + '\t' + std::to_string(e.mtime) + '\n';
+        }
+
+        // Write response headers. An empty listing has no content-length.
+        string headers {"status:200\n"};
+        if (!body.empty())
+            headers += "content-length:" + std::to_string(body.size()) + '\n';
+        headers += "date:" + std::to_string(date) + "\n\n";
+        if (common::write_bytes(cfd, headers.data(), headers.size()) != 0
+            || common::write_bytes(cfd, body.data(), body.size()) != 0) {
+            perror("\nwrite socket");
+            return -1;
+        }
+        return 0;
+    }
+} // unnamed namespace
+
+// Create the content-addressed store if needed, and remove what an earlier
+// run left behind. Return 0 on success, or -1 on error.
+int common::init_store()
+{
+    std::error_code ec;
+    fs::create_directories(BLOB_DIR, ec);
+    if (ec) {
+        cerr << "create " << BLOB_DIR << " failed: " << ec.message() << endl;
+        return -1;
+    }
+    std::lock_guard lock {store_mutex};
+    collect_garbage(true);
+    return 0;
+}
+
+// Write response headers to CFD. A nonzero RETRY_AFTER tells the client how
+// many seconds to wait before trying again. Return 0 on success, or -1 on error.
+int common::write_res_headers(int cfd, int status_code, ssize_t filesize, int retry_after)
+{
+    string headers {"status:" + std::to_string(status_code) + '\n'};
+    if (filesize > 0)
+        headers += "content-length:" + std::to_string(filesize) + '\n';
+    if (retry_after > 0)
+        headers += "retry-after:" + std::to_string(retry_after) + '\n';
+    headers += '\n';
+
+    if (common::write_bytes(cfd, headers.data(), headers.size()) != 0) {
+        perror("\nwrite socket");
+        return -1;
+    }
+    return 0;
+}
+
+// Decide whether an upload of FILESIZE bytes can be accepted right now,
+// and if so reserve its share of the in-flight budget. If not, answer CFD
+// straight away so the client is not left streaming data we cannot take.
+// Return 0 if admitted, or -1 if rejected.
+int common::admit_upload(int cfd, size_t filesize, const server_options& options,
+    thread_pool& disk)
+{
+    if (filesize == 0) {
+        cerr << "rejected: empty upload" << endl;
+        write_res_headers(cfd, 400); // 400 Bad Request
+        return -1;
+    }
+    if (options.max_file > 0 && filesize > options.max_file) {
+        cerr << "rejected: " << filesize << " bytes exceeds per-file cap" << endl;
+        write_res_headers(cfd, 413); // 413 Payload Too Large
+        return -1;
+    }
+
+    struct statvfs sv {};
+    const bool have_sv {disk.submit([&] { return statvfs(BLOB_DIR.c_str(), &sv); }).get() == 0};
+    const size_t avail {sv.f_bavail * sv.f_frsize};
+
+    int status_code {};
+    {
+        std::lock_guard lock {in_flight_mutex};
+        if (have_sv && filesize > avail) {
+            cerr << "rejected: " << filesize << " bytes exceeds free space" << endl;
+            status_code = 507; // 507 Insufficient Storage
+        }
+        else if (have_sv && filesize + in_flight_bytes > avail) {
+            // Space promised to uploads still in flight is not free yet
+            cerr << "rejected: free space is reserved by uploads in flight" << endl;
+            status_code = 503; // 503 Service Unavailable
+        }
+        else if (in_flight_bytes > 0 && filesize + in_flight_bytes > options.budget) {
+            // An upload larger than the whole budget is still let in on
+            // its own, otherwise it could never be admitted
+            cerr << "rejected: in-flight budget exhausted" << endl;
+            status_code = 503;
+        }
+        else {
+            in_flight_bytes += filesize;
+        }
+    }
+
+    if (status_code != 0) {
+        write_res_headers(cfd, status_code, 0, status_code == 503 ? RETRY_AFTER : 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Give back the share of the in-flight budget reserved by admit_upload().
+void common::release_upload(size_t filesize)
+{
+    std::lock_guard lock {in_flight_mutex};
+    in_flight_bytes -= filesize;
+}
+
+// Serve one request from the client connected on CFD from REM_ADDR via
+// local adapter DEV_ID. Runs on its own thread, so it only ever waits on
+// its own disk operations.
+int common::serve_client(int cfd, sockaddr_rc rem_addr, int dev_id,
+    const server_options& options, thread_pool& disk)
+{
+    // Print address and name of remote bluetooth device
+    char bdaddr[18] {};
+    ba2str(&rem_addr.rc_bdaddr, bdaddr);
+    const auto& bdname {common::get_remote_bdname(&rem_addr.rc_bdaddr, dev_id)};
+    printf("Accepted connection from %s %s\n", bdaddr, bdname.c_str());
+
+    // Read and parse headers sent by client
+    const auto& headers {common::read_headers(cfd)};
+    if (headers.size() == 0) {
+        cerr << "read_headers error" << endl;
+        close(cfd);
+        return -1;
+    }
+    const auto& map {common::parse_headers(headers)};
+    if (map.empty()) {
+        cerr << "parse_headers error" << endl;
+        close(cfd);
+        return -1;
+    }
+    for (const auto& [k, v] : map) {
+        cout << "  " << k << ':' << v << endl;
+    }
+
+    int status {-1};
+    try {
+        // Call put_file(), get_file(), get_files() or list_files(),
+        // depending on the "method" header
+        const std::string_view method {map.at("method")};
+        if (method == "PUT") {
+            const fs::path p {map.at("pathname")};
+            const fs::path dir {"transfer"};
+            const fs::path pathname {dir / p.filename()};
+            const size_t filesize {std::stoul(map.at("content-length"))};
+            const auto& it {map.find("content-sha256")};
+            const string digest {it != map.end() ? it->second : ""};
+            if (!digest.empty() && !is_valid_digest(digest)) {
+                cerr << "invalid content-sha256: " << digest << endl;
+                write_res_headers(cfd, 400);
+            }
+            else {
+                status = put_file(cfd, pathname, filesize, digest, options, disk);
+            }
+        }
+        else if (method == "GET") {
+            // One pathname in the headers, or many in a request body
+            const auto& it {map.find("pathname")};
+            if (it != map.end()) {
+                status = get_file(cfd, it->second, options.bounds, disk);
+            }
+            else {
+                const size_t length {std::stoul(map.at("content-length"))};
+                status = get_files(cfd, length, options.bounds, disk);
+            }
+        }
+        else if (method == "LIST") {
+            const auto& it {map.find("if-modified-since")};
+            const int64_t since {it != map.end()
+                ? std::stoll(it->second) : std::numeric_limits<int64_t>::min()};
+            status = list_files(cfd, since, disk);
+        }
+        else {
+            cerr << "invalid method: " << method << endl;
+        }
+    }
+    catch (const std::logic_error& ex) {
+        // Malformed headers must not take down the whole server
+        cerr << "invalid request: " << ex.what() << endl;
+    }
+
+    // Cleanup
+    close(cfd);
+    return status;
+}
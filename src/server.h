@@ -0,0 +1,48 @@
+// server.h
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/rfcomm.h>
+#include "thread_pool.h"
+#include "tuner.h"
+
+namespace common
+{
+    // Seconds a client is told to wait before retrying a rejected request
+    inline constexpr int RETRY_AFTER {5};
+
+    struct server_options {
+        uint8_t channel;
+        tuner_bounds bounds;
+        size_t max_file;    // largest upload accepted, or 0 for no limit
+        size_t budget;      // bytes of uploads that may be in flight at once
+        unsigned threads;   // clients served at once, or 0 for one per core
+    };
+
+    // Create the content-addressed store under "transfer" if needed, and
+    // remove what an earlier run left behind. Return 0 on success, or -1 on error.
+    int init_store();
+
+    // Write response headers to CFD. A nonzero RETRY_AFTER tells the client how
+    // many seconds to wait before trying again. Return 0 on success, or -1 on error.
+    int write_res_headers(int cfd, int status_code, ssize_t filesize = 0, int retry_after = 0);
+
+    // Decide whether an upload of FILESIZE bytes can be accepted right now,
+    // and if so reserve its share of the in-flight budget until
+    // release_upload(). If not, answer CFD straight away.
+    // Return 0 if admitted, or -1 if rejected.
+    int admit_upload(int cfd, size_t filesize, const server_options& options, thread_pool& disk);
+    void release_upload(size_t filesize);
+
+    // Serve one request from the client connected on CFD from REM_ADDR via
+    // local adapter DEV_ID, then close CFD. Return 0 on success, or -1 on error.
+    int serve_client(int cfd, sockaddr_rc rem_addr, int dev_id,
+        const server_options& options, thread_pool& disk);
+}
+
+#endif // SERVER_H
@@ -0,0 +1,35 @@
+// sha256.h
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace common
+{
+    // Streaming SHA-256 (FIPS 180-4). Feed data with update() as it is read,
+    // then call hexdigest() once to get the 64-character lowercase digest.
+    class sha256 {
+    public:
+        sha256();
+        void update(const void *data, size_t n);
+        std::string hexdigest();
+
+    private:
+        void transform(const uint8_t *block);
+
+        std::array<uint32_t, 8> state_;
+        std::array<uint8_t, 64> block_;
+        size_t block_len_;
+        uint64_t total_len_;
+    };
+
+    // Return the SHA-256 hex digest of the file at PATHNAME, or an empty
+    // string on error.
+    std::string sha256_file(const char *pathname);
+}
+
+#endif // SHA256_H
@@ -0,0 +1,101 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace {
+    // The pool the current thread works for, or NULL when it is not a pool
+    // worker, and the index of its queue in that pool. Jobs may be submitted
+    // to one pool from a worker of another, so the index means nothing
+    // unless the pool matches.
+    thread_local const common::thread_pool *worker_pool {};
+    thread_local size_t worker_index {};
+} // unnamed namespace
+
+common::thread_pool::thread_pool(unsigned threads)
+    : next_ {}, pending_ {}, stopping_ {}
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i {}; i < threads; i++)
+        queues_.push_back(std::make_unique<queue_t>());
+    for (unsigned i {}; i < threads; i++)
+        workers_.emplace_back(&thread_pool::run, this, i);
+}
+
+// Let queued jobs finish, then stop and join all workers.
+common::thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock {idle_mutex_};
+        stopping_ = true;
+    }
+    idle_.notify_all();
+    for (auto& w : workers_)
+        w.join();
+}
+
+// Queue JOB on the calling worker's own queue if it works for this pool, or
+// spread jobs from other threads round-robin across all queues.
+void common::thread_pool::push(std::function<void()> job)
+{
+    const size_t target = worker_pool == this
+        ? worker_index
+        : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    {
+        std::lock_guard lock {queues_[target]->mutex};
+        queues_[target]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard lock {idle_mutex_};
+        pending_++;
+    }
+    idle_.notify_one();
+}
+
+// Take the newest job from queue SELF, or else steal the oldest job from
+// another queue. Return true if JOB was set.
+bool common::thread_pool::pop(size_t self, std::function<void()>& job)
+{
+    {
+        auto& q {*queues_[self]};
+        std::lock_guard lock {q.mutex};
+        if (!q.jobs.empty()) {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+            return true;
+        }
+    }
+    for (size_t i {1}; i < queues_.size(); i++) {
+        auto& q {*queues_[(self + i) % queues_.size()]};
+        std::lock_guard lock {q.mutex};
+        if (!q.jobs.empty()) {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void common::thread_pool::run(size_t self)
+{
+    worker_pool = this;
+    worker_index = self;
+    while (true) {
+        {
+            std::unique_lock lock {idle_mutex_};
+            idle_.wait(lock, [this] { return pending_ > 0 || stopping_; });
+            if (pending_ == 0)
+                return; // stopping and nothing left to do
+            pending_--;
+        }
+
+        // A job was counted, so one is queued somewhere, but other workers
+        // taking jobs at the same time may make us look more than once
+        std::function<void()> job;
+        while (!pop(self, job))
+            std::this_thread::yield();
+        job();
+    }
+}
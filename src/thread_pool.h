@@ -0,0 +1,65 @@
+// thread_pool.h
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace common
+{
+    // Fixed-size pool of worker threads. Each worker has its own queue: it
+    // takes its newest job first and, when that runs dry, steals the oldest
+    // job from another worker, so a worker stuck on one slow job does not
+    // strand the jobs queued behind it.
+    class thread_pool {
+    public:
+        // Start THREADS workers, or one per core if THREADS is 0
+        explicit thread_pool(unsigned threads = 0);
+        ~thread_pool();
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        size_t size() const { return queues_.size(); }
+
+        // Queue F to run on a worker. The returned future becomes ready
+        // with F's result once it has run.
+        template<typename F>
+        auto submit(F&& f) -> std::future<std::invoke_result_t<F>>
+        {
+            using R = std::invoke_result_t<F>;
+            auto task {std::make_shared<std::packaged_task<R()>>(std::forward<F>(f))};
+            auto future {task->get_future()};
+            push([task] { (*task)(); });
+            return future;
+        }
+
+    private:
+        struct queue_t {
+            std::mutex mutex;
+            std::deque<std::function<void()>> jobs;
+        };
+
+        void push(std::function<void()> job);
+        bool pop(size_t self, std::function<void()>& job);
+        void run(size_t self);
+
+        std::vector<std::unique_ptr<queue_t>> queues_;
+        std::vector<std::thread> workers_;
+        std::atomic<size_t> next_;      // round-robin target for push()
+        std::mutex idle_mutex_;
+        std::condition_variable idle_;
+        size_t pending_;                // queued jobs, guarded by idle_mutex_
+        bool stopping_;                 // guarded by idle_mutex_
+    };
+}
+
+#endif // THREAD_POOL_H
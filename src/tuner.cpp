@@ -0,0 +1,189 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "common.h"
+#include "tuner.h"
+
+namespace {
+    using namespace std::chrono_literals;
+
+    // A window must span both this much time and this many chunks before we
+    // act on it, so one slow write does not whipsaw the chunk size.
+    constexpr auto WINDOW_TIME {250ms};
+    constexpr size_t WINDOW_CHUNKS {4};
+
+    // Above this fraction of time spent blocked in the socket call, the link
+    // is the bottleneck. A bigger chunk may still save per-packet overhead,
+    // but it has to prove that, or it would only sit in the buffer.
+    constexpr double LINK_BOUND {0.9};
+
+    // Throughput must fall by more than this before we change direction,
+    // to ride out normal jitter.
+    constexpr double TOLERANCE {0.05};
+
+    // After undoing a bad step, keep the chunk size for this many windows
+    // before probing again, in case the link has changed since.
+    constexpr int HOLD_WINDOWS {8};
+
+    // Return the largest power of two not greater than N, or 1 if N is 0.
+    size_t floor_pow2(size_t n)
+    {
+        size_t p {1};
+        while (p <= n / 2)
+            p *= 2;
+        return p;
+    }
+} // unnamed namespace
+
+// Parse "MIN:MAX" into BOUNDS. Return 0 on success, or -1 on error.
+int common::parse_tuner_bounds(const char *s, tuner_bounds *bounds)
+{
+    try {
+        const std::string str {s};
+        const auto& index {str.find(':')};
+        if (index == std::string::npos)
+            return -1;
+        const size_t min {std::stoul(str.substr(0, index))};
+        const size_t max {std::stoul(str.substr(index + 1))};
+        if (min < 1 || min > max)
+            return -1;
+        bounds->min_chunk = min;
+        bounds->max_chunk = max;
+        return 0;
+    }
+    catch (const std::logic_error& ex) {
+        return -1;
+    }
+}
+
+common::tuner::tuner(int sfd, tuner_bounds bounds)
+    : sfd_ {sfd}, bounds_ {bounds}, chunk_ {}, prev_chunk_ {}, min_sockbuf_ {},
+      direction_ {1}, hold_ {}, need_gain_ {}, last_rate_ {}, window_start_ {clock::now()},
+      window_bytes_ {}, window_blocked_ {}
+{
+    // Start from the smaller of the two socket buffers the kernel gave us.
+    // Half a buffer per chunk keeps one chunk in flight while the next is
+    // being prepared. RFCOMM does not report a link MTU, so this is the best
+    // hint the socket offers.
+    int sndbuf {}, rcvbuf {};
+    socklen_t len {sizeof(int)};
+    getsockopt(sfd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+    len = sizeof(int);
+    getsockopt(sfd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+    const int reported {std::max(0, std::min(sndbuf, rcvbuf))};
+
+    // Linux reports twice the size that was set, to allow for its own
+    // bookkeeping, and doubles whatever we set. Keep the size as it would be
+    // set, or every new tuner on the socket would double the buffers again.
+    min_sockbuf_ = reported / 2;
+
+    const size_t initial {reported > 0 ? floor_pow2(reported / 2) : bounds_.min_chunk};
+    set_chunk(initial);
+    prev_chunk_ = chunk_;
+}
+
+// Read at most chunk_size() bytes, and no more than LIMIT, from the socket
+// into BUF. Return the number of bytes read, 0 on end of file, or -1 on error.
+ssize_t common::tuner::read(void *buf, size_t limit)
+{
+    const auto start {clock::now()};
+    const ssize_t bytes_read {::read(sfd_, buf, std::min(chunk_, limit))};
+    if (bytes_read > 0)
+        record(bytes_read, clock::now() - start);
+    return bytes_read;
+}
+
+// Write N bytes of BUF to the socket. Return 0 on success, or -1 on error.
+int common::tuner::write(const void *buf, ssize_t n)
+{
+    const auto start {clock::now()};
+    if (common::write_bytes(sfd_, buf, n) != 0)
+        return -1;
+    record(n, clock::now() - start);
+    return 0;
+}
+
+// Account for BYTES moved in one chunk, of which BLOCKED was spent waiting in
+// the socket call. At the end of each sampling window, grow or shrink the
+// chunk size by climbing towards higher throughput.
+void common::tuner::record(size_t bytes, clock::duration blocked)
+{
+    window_bytes_ += bytes;
+    window_blocked_ += blocked;
+
+    const auto now {clock::now()};
+    const auto elapsed {now - window_start_};
+    if (elapsed < WINDOW_TIME || window_bytes_ < WINDOW_CHUNKS * chunk_)
+        return;
+
+    const double seconds {std::chrono::duration<double>(elapsed).count()};
+    const double rate {window_bytes_ / seconds};
+    const double blocked_frac {std::chrono::duration<double>(window_blocked_).count() / seconds};
+
+    const double prev_rate {last_rate_};
+    last_rate_ = rate;
+
+    if (hold_ > 0) {
+        // Settled after a bad step; sit still for a while before probing again
+        hold_--;
+    }
+    else if (chunk_ != prev_chunk_
+        && rate < prev_rate * (need_gain_ ? 1 : 1 - TOLERANCE)) {
+        // The last step made things worse, so undo it and settle there. The
+        // undo is not a step of its own, or the first window after the hold
+        // would be judged against the bad size and step right back to it.
+        set_chunk(prev_chunk_);
+        prev_chunk_ = chunk_;
+        direction_ = -direction_;
+        hold_ = HOLD_WINDOWS;
+    }
+    else {
+        // Keep stepping the same way while it pays off. While the link is
+        // saturated, the next step is only kept if it makes things better.
+        need_gain_ = blocked_frac >= LINK_BOUND;
+        prev_chunk_ = chunk_;
+        set_chunk(direction_ > 0 ? chunk_ * 2 : chunk_ / 2);
+    }
+
+    // Turn around at the bounds instead of pushing against them
+    if (chunk_ >= bounds_.max_chunk)
+        direction_ = -1;
+    else if (chunk_ <= bounds_.min_chunk)
+        direction_ = 1;
+
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_blocked_ = {};
+}
+
+void common::tuner::set_chunk(size_t chunk)
+{
+    chunk = std::clamp(chunk, bounds_.min_chunk, bounds_.max_chunk);
+    if (chunk == chunk_)
+        return;
+    chunk_ = chunk;
+    set_sockbuf();
+}
+
+// Size the socket buffers to hold a few chunks, but never shrink them below
+// what the kernel chose, and log the values in effect.
+void common::tuner::set_sockbuf()
+{
+    const int want {std::max<int>(min_sockbuf_, 4 * chunk_)};
+    setsockopt(sfd_, SOL_SOCKET, SO_SNDBUF, &want, sizeof(want));
+    setsockopt(sfd_, SOL_SOCKET, SO_RCVBUF, &want, sizeof(want));
+
+    int sndbuf {}, rcvbuf {};
+    socklen_t len {sizeof(int)};
+    getsockopt(sfd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+    len = sizeof(int);
+    getsockopt(sfd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+    std::cerr << "\ntuner: chunk " << chunk_ << " sndbuf " << sndbuf
+        << " rcvbuf " << rcvbuf;
+    if (last_rate_ > 0)
+        std::cerr << " (" << (size_t) last_rate_ << " B/s)";
+    std::cerr << std::endl;
+}
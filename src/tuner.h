@@ -0,0 +1,60 @@
+// tuner.h
+
+#ifndef TUNER_H
+#define TUNER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace common
+{
+    // Bounds on the chunk size, in bytes, that a tuner may pick.
+    struct tuner_bounds {
+        size_t min_chunk;
+        size_t max_chunk;
+    };
+
+    inline constexpr tuner_bounds DEFAULT_TUNER_BOUNDS {1024, 64 * 1024};
+
+    // Parse "MIN:MAX" into BOUNDS. Return 0 on success, or -1 on error.
+    int parse_tuner_bounds(const char *s, tuner_bounds *bounds);
+
+    // Picks the chunk size and socket buffer sizes for a transfer on a socket,
+    // starting from what the socket reports and adjusting both from measured
+    // throughput while the transfer runs. Buffers passed to read() must hold
+    // max_chunk() bytes; senders should fill at most chunk_size() per write().
+    class tuner {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        tuner(int sfd, tuner_bounds bounds = DEFAULT_TUNER_BOUNDS);
+        size_t chunk_size() const { return chunk_; }
+        size_t max_chunk() const { return bounds_.max_chunk; }
+        ssize_t read(void *buf, size_t limit = SIZE_MAX);
+        int write(const void *buf, ssize_t n);
+
+    private:
+        void record(size_t bytes, clock::duration blocked);
+        void set_chunk(size_t chunk);
+        void set_sockbuf();
+
+        int sfd_;
+        tuner_bounds bounds_;
+        size_t chunk_;
+        size_t prev_chunk_; // chunk size before the last step
+        int min_sockbuf_;   // what the kernel gave us, as set; never tune below it
+        int direction_;     // +1 while growing the chunk, -1 while shrinking
+        int hold_;          // windows left before probing again
+        bool need_gain_;    // undo the last step unless throughput went up
+        double last_rate_;  // bytes per second in the previous window
+
+        // Measurements for the current sampling window
+        clock::time_point window_start_;
+        size_t window_bytes_;
+        clock::duration window_blocked_;
+    };
+}
+
+#endif // TUNER_H
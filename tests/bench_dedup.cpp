@@ -0,0 +1,78 @@
+#define __cplusplus 201703L
+#include <string>
+#include <vector>
+#include "sha256.h"
+#include "test.h"
+
+// Upload the same workload with and without content-sha256 and report the
+// bytes each put on the wire. The workload is UPLOADS files drawn from
+// DISTINCT contents of SIZE bytes each, as when the same photos are sent
+// again under new names.
+//
+// Usage: bench_dedup [UPLOADS [DISTINCT [SIZE]]]
+
+namespace {
+    using std::string;
+
+    struct result_t {
+        size_t bytes_sent;
+        size_t skipped;
+        double seconds;
+    };
+
+    result_t run(const std::vector<string>& contents, size_t uploads, bool send_digest,
+        const common::server_options& options, common::thread_pool& disk)
+    {
+        result_t result {};
+        const auto start {test::clock::now()};
+        for (size_t i {}; i < uploads; i++) {
+            const string& content {contents[i % contents.size()]};
+            string digest;
+            if (send_digest) {
+                common::sha256 hash;
+                hash.update(content.data(), content.size());
+                digest = hash.hexdigest();
+            }
+            const string pathname {(send_digest ? "dedup." : "plain.") + std::to_string(i)};
+            const auto& res {test::rpc(test::put_request(pathname, content.size(), digest),
+                content, options, disk)};
+            result.bytes_sent += res.bytes_sent;
+            if (res.headers.count("status") && res.headers.at("status") == "208")
+                result.skipped++;
+        }
+        result.seconds = test::seconds_since(start);
+        return result;
+    }
+} // unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t uploads {argc > 1 ? std::stoul(argv[1]) : 200};
+    const size_t distinct {argc > 2 ? std::stoul(argv[2]) : 20};
+    const size_t size {argc > 3 ? std::stoul(argv[3]) : 256 * 1024};
+
+    test::enter_scratch_dir();
+    std::vector<string> contents;
+    for (size_t i {}; i < distinct; i++) {
+        string content(size, '\0');
+        for (size_t j {}; j < size; j++)
+            content[j] = char(j * 13 + i * 101 + j / 251);
+        contents.push_back(content);
+    }
+
+    const common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 64 * 1024 * 1024, 2};
+    common::thread_pool disk {2};
+    const result_t plain {run(contents, uploads, false, options, disk)};
+    const result_t dedup {run(contents, uploads, true, options, disk)};
+
+    fprintf(test::out, "\n%zu uploads of %zu distinct files, %zu bytes each\n", uploads, distinct, size);
+    fprintf(test::out, "%-16s %14s %10s %10s\n", "", "wire bytes", "skipped", "seconds");
+    fprintf(test::out, "%-16s %14zu %10zu %10.3f\n", "no digest", plain.bytes_sent, plain.skipped,
+        plain.seconds);
+    fprintf(test::out, "%-16s %14zu %10zu %10.3f\n", "content-sha256", dedup.bytes_sent, dedup.skipped,
+        dedup.seconds);
+    fprintf(test::out, "saved %zu bytes (%.1f%%)\n", plain.bytes_sent - dedup.bytes_sent,
+        100.0 * (plain.bytes_sent - dedup.bytes_sent) / plain.bytes_sent);
+    test::remove_scratch_dir();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#define __cplusplus 201703L
+#include <fstream>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+#include "test.h"
+
+// Find out what a server with COUNT files holds and fetch it all, once with
+// LIST and one batched GET, and once with a GET per file, and report how
+// long each step takes. LIST is timed cold, warm, after one more file, and
+// with if-modified-since.
+//
+// Usage: bench_list [COUNT]
+
+namespace {
+    using std::string;
+
+    const common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 1000, 1};
+
+    struct timed_t {
+        test::response res;
+        double seconds;
+    };
+
+    timed_t timed_rpc(const string& request, common::thread_pool& disk)
+    {
+        const auto start {test::clock::now()};
+        auto res {test::rpc(request, "", options, disk)};
+        return {std::move(res), test::seconds_since(start)};
+    }
+
+    void print(const char *label, double seconds, size_t bytes)
+    {
+        fprintf(test::out, "%-28s %10.1f ms %12zu bytes\n", label, seconds * 1e3, bytes);
+    }
+
+    size_t count_lines(const string& body)
+    {
+        size_t lines {};
+        for (char c : body)
+            lines += c == '\n';
+        return lines;
+    }
+} // unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    const size_t count {argc > 1 ? std::stoul(argv[1]) : 50000};
+    test::enter_scratch_dir();
+    common::thread_pool disk {1};
+
+    // The files are from earlier on, so a listing since now has only what
+    // comes after
+    const auto earlier {std::filesystem::file_time_type::clock::now() - std::chrono::hours {1}};
+    std::vector<string> pathnames;
+    for (size_t i {}; i < count; i++) {
+        pathnames.push_back("transfer/file." + std::to_string(i));
+        std::ofstream {pathnames.back()} << "contents of file " << i << '\n';
+        std::filesystem::last_write_time(pathnames.back(), earlier);
+    }
+    fprintf(test::out, "\n%zu files\n", count);
+
+    auto list {timed_rpc("method:LIST\n\n", disk)};
+    print("LIST, cold", list.seconds, list.res.body.size());
+    if (count_lines(list.res.body) != count)
+        fprintf(test::out, "LIST returned %zu entries\n", count_lines(list.res.body));
+    list = timed_rpc("method:LIST\n\n", disk);
+    print("LIST, warm", list.seconds, list.res.body.size());
+
+    const string since {list.res.headers["date"]};
+    std::ofstream {"transfer/one-more"} << "one more\n";
+    list = timed_rpc("method:LIST\n\n", disk);
+    print("LIST, after one more file", list.seconds, list.res.body.size());
+    list = timed_rpc("method:LIST\nif-modified-since:" + since + "\n\n", disk);
+    print("LIST, if-modified-since", list.seconds, list.res.body.size());
+
+    string body;
+    for (const auto& pathname : pathnames)
+        body += pathname + '\n';
+    const auto& batch {timed_rpc("method:GET\ncontent-length:" + std::to_string(body.size())
+        + "\n\n" + body, disk)};
+    print("GET, one batch", batch.seconds, batch.res.body.size());
+
+    const auto start {test::clock::now()};
+    size_t bytes {};
+    for (const auto& pathname : pathnames)
+        bytes += test::rpc("method:GET\npathname:" + pathname + "\n\n", "", options, disk).body.size();
+    print("GET, one request per file", test::seconds_since(start), bytes);
+
+    test::remove_scratch_dir();
+    return EXIT_SUCCESS;
+}
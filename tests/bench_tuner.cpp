@@ -0,0 +1,114 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include "tuner.h"
+#include "test.h"
+
+// Send through a shaped loopback link with the chunk size tuned, and with
+// each fixed chunk size the tuner may pick, and report the throughput of
+// each. The link is a SOCK_SEQPACKET socket pair, so every chunk stays one
+// packet, read by a peer that is throttled to a byte rate and pays a fixed
+// latency per packet, as an RFCOMM link does per frame. Socket buffers
+// start small, as they do on RFCOMM.
+//
+// Usage: bench_tuner [SECONDS]
+
+namespace {
+    using namespace std::chrono_literals;
+
+    struct link_t {
+        const char *name;
+        double rate;                        // bytes per second, or 0 for no limit
+        std::chrono::microseconds latency;  // per packet
+    };
+
+    const link_t LINKS[] {
+        {"loopback", 0, 0us},
+        {"1 MB/s", 1e6, 0us},
+        {"1 MB/s, 200us", 1e6, 200us},
+        {"256 KB/s, 2ms", 256e3, 2000us},
+        {"64 KB/s, 5ms", 64e3, 5000us},
+    };
+
+    struct result_t {
+        double rate;        // bytes per second received
+        size_t chunk;       // chunk size at the end
+    };
+
+    // Read from SFD until end of file, at the pace of LINK. Return the bytes read.
+    size_t throttled_peer(int sfd, const link_t& link)
+    {
+        std::vector<char> buf(1024 * 1024);
+        size_t total {};
+        auto busy_until {test::clock::now()};
+        ssize_t n;
+        while ((n = read(sfd, buf.data(), buf.size())) > 0) {
+            // The link is busy for the latency plus the time the packet
+            // takes at the byte rate
+            total += n;
+            busy_until = std::max(busy_until, test::clock::now()) + link.latency;
+            if (link.rate > 0)
+                busy_until += std::chrono::duration_cast<test::clock::duration>(
+                    std::chrono::duration<double>(n / link.rate));
+            std::this_thread::sleep_until(busy_until);
+        }
+        return total;
+    }
+
+    result_t run(const link_t& link, common::tuner_bounds bounds, double seconds)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+            perror("socketpair");
+            exit(EXIT_FAILURE);
+        }
+        const int small {4096};
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+        setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+        size_t received {};
+        const auto start {test::clock::now()};
+        std::thread peer {[&] { received = throttled_peer(sv[1], link); }};
+
+        common::tuner tuner {sv[0], bounds};
+        std::vector<char> buf(tuner.max_chunk(), 'x');
+        while (test::seconds_since(start) < seconds) {
+            if (tuner.write(buf.data(), tuner.chunk_size()) != 0)
+                break;
+        }
+        shutdown(sv[0], SHUT_WR);
+        peer.join();
+        const double elapsed {test::seconds_since(start)};
+        close(sv[0]);
+        close(sv[1]);
+        return {received / elapsed, tuner.chunk_size()};
+    }
+} // unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    const double seconds {argc > 1 ? std::stod(argv[1]) : 2.0};
+    const common::tuner_bounds tuned {common::DEFAULT_TUNER_BOUNDS};
+    std::vector<size_t> fixed;
+    for (size_t chunk {tuned.min_chunk}; chunk <= tuned.max_chunk; chunk *= 4)
+        fixed.push_back(chunk);
+
+    test::enter_scratch_dir();
+    fprintf(test::out, "\nthroughput in KB/s over %.1f s per run\n%-16s", seconds, "link");
+    for (size_t chunk : fixed)
+        fprintf(test::out, " %9s", ("fixed " + std::to_string(chunk / 1024) + "K").c_str());
+    fprintf(test::out, " %9s %6s\n", "tuned", "chunk");
+
+    for (const auto& link : LINKS) {
+        fprintf(test::out, "%-16s", link.name);
+        for (size_t chunk : fixed)
+            fprintf(test::out, " %9.0f", run(link, {chunk, chunk}, seconds).rate / 1e3);
+        const result_t result {run(link, tuned, seconds)};
+        fprintf(test::out, " %9.0f %5zuK\n", result.rate / 1e3, result.chunk / 1024);
+    }
+    test::remove_scratch_dir();
+    return EXIT_SUCCESS;
+}
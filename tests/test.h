@@ -0,0 +1,142 @@
+// test.h
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "common.h"
+#include "server.h"
+#include "thread_pool.h"
+
+// Report a failed check without stopping, so one run shows every failure
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(test::out, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test::failures++; \
+        } \
+    } while (0)
+
+namespace test
+{
+    using clock = std::chrono::steady_clock;
+
+    inline std::atomic<int> failures {};
+
+    // Where results go. The code under test talks on stdout and stderr,
+    // which enter_scratch_dir() sends to a log file instead.
+    inline FILE *out {stderr};
+    inline std::string scratch_dir;
+
+    inline void remove_scratch_dir()
+    {
+        std::error_code ec;
+        if (!scratch_dir.empty())
+            std::filesystem::remove_all(scratch_dir, ec);
+    }
+
+    // Return EXIT_SUCCESS if no check has failed, or EXIT_FAILURE otherwise.
+    // The scratch directory is kept for a look at what went wrong.
+    inline int report(const char *name)
+    {
+        if (failures == 0) {
+            fprintf(out, "%s: passed\n", name);
+            remove_scratch_dir();
+            return EXIT_SUCCESS;
+        }
+        fprintf(out, "%s: FAILED, see %s/server.log\n", name, scratch_dir.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Create an empty scratch directory with the server's store in it, make
+    // it the current directory, and log server output to "server.log" there.
+    inline void enter_scratch_dir()
+    {
+        char dir[] {"/tmp/bt-dev-test.XXXXXX"};
+        if (mkdtemp(dir) == NULL || chdir(dir) == -1) {
+            perror("scratch dir");
+            exit(EXIT_FAILURE);
+        }
+        scratch_dir = dir;
+
+        const int log = open("server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log == -1 || (out = fdopen(dup(STDERR_FILENO), "w")) == NULL) {
+            perror("server.log");
+            exit(EXIT_FAILURE);
+        }
+        setvbuf(out, NULL, _IOLBF, 0);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        close(log);
+
+        if (common::init_store() != 0)
+            exit(EXIT_FAILURE);
+    }
+
+    // Return the seconds elapsed since START.
+    inline double seconds_since(clock::time_point start)
+    {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    struct response {
+        std::map<std::string, std::string> headers;
+        std::string body;       // everything after the response headers
+        size_t bytes_sent;      // bytes the client put on the wire
+    };
+
+    // Send REQUEST to a server connection served on a thread of its own, and
+    // send UPLOAD after it only if the server answers 200. REQUEST holds the
+    // request headers, and any request body the server reads before it answers.
+    inline response rpc(const std::string& request, const std::string& upload,
+        const common::server_options& options, common::thread_pool& disk)
+    {
+        response res {};
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            exit(EXIT_FAILURE);
+        }
+        std::thread server {[&] { common::serve_client(sv[1], sockaddr_rc {}, -1, options, disk); }};
+
+        if (common::write_bytes(sv[0], request.data(), request.size()) == 0)
+            res.bytes_sent += request.size();
+        res.headers = common::parse_headers(common::read_headers(sv[0]));
+        if (res.headers["status"] == "200" && !upload.empty()
+            && common::write_bytes(sv[0], upload.data(), upload.size()) == 0)
+            res.bytes_sent += upload.size();
+        shutdown(sv[0], SHUT_WR);
+
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(sv[0], buf, sizeof(buf))) > 0)
+            res.body.append(buf, n);
+
+        server.join();
+        close(sv[0]);
+        return res;
+    }
+
+    // Return the headers of a PUT request for PATHNAME
+    inline std::string put_request(const std::string& pathname, size_t length,
+        const std::string& digest = "")
+    {
+        std::string request {"method:PUT\npathname:" + pathname
+            + "\ncontent-length:" + std::to_string(length) + '\n'};
+        if (!digest.empty())
+            request += "content-sha256:" + digest + '\n';
+        return request + '\n';
+    }
+}
+
+#endif // TEST_H
@@ -0,0 +1,110 @@
+#define __cplusplus 201703L
+#include <map>
+#include <string>
+#include <vector>
+#include "adapter.h"
+#include "test.h"
+
+namespace {
+    using common::adapter_t;
+
+    // Adapters with made-up loads, keyed by name. Adapters missing from the
+    // loads report -1, as when the connection list cannot be read.
+    class fake_source : public common::adapter_source {
+    public:
+        fake_source(std::vector<adapter_t> adapters, std::map<std::string, int> loads)
+            : adapters_ {std::move(adapters)}, loads_ {std::move(loads)}
+        {
+        }
+
+        std::vector<adapter_t> adapters() const override { return adapters_; }
+
+        int load(const adapter_t& adapter) const override
+        {
+            const auto& it {loads_.find(adapter.name)};
+            return it != loads_.end() ? it->second : -1;
+        }
+
+    private:
+        std::vector<adapter_t> adapters_;
+        std::map<std::string, int> loads_;
+    };
+
+    const std::vector<adapter_t> THREE {{0, "hci0", {}}, {1, "hci1", {}}, {2, "hci2", {}}};
+
+    // Return the name of the adapter pick_adapter() chooses, or "none"
+    std::string pick(const std::vector<adapter_t>& adapters, std::map<std::string, int> loads)
+    {
+        adapter_t adapter {-2, "untouched", {}};
+        if (common::pick_adapter(fake_source {adapters, loads}, &adapter) != 0)
+            return adapter.name == "untouched" ? "none" : "changed on failure";
+        return adapter.name;
+    }
+
+    void test_pick_least_loaded()
+    {
+        CHECK(pick(THREE, {{"hci0", 3}, {"hci1", 1}, {"hci2", 2}}) == "hci1");
+        CHECK(pick(THREE, {{"hci0", 0}, {"hci1", 1}, {"hci2", 2}}) == "hci0");
+        CHECK(pick(THREE, {{"hci0", 5}, {"hci1", 5}, {"hci2", 0}}) == "hci2");
+    }
+
+    // Ties go to the adapter listed first
+    void test_pick_tie()
+    {
+        CHECK(pick(THREE, {{"hci0", 1}, {"hci1", 1}, {"hci2", 1}}) == "hci0");
+        CHECK(pick(THREE, {{"hci0", 2}, {"hci1", 1}, {"hci2", 1}}) == "hci1");
+    }
+
+    // An adapter whose load is unknown loses to any adapter whose load is
+    // known, however busy, but is still picked when it is all there is
+    void test_pick_unknown_load()
+    {
+        CHECK(pick(THREE, {{"hci1", 7}}) == "hci1");
+        CHECK(pick(THREE, {{"hci2", 1000}}) == "hci2");
+        CHECK(pick(THREE, {}) == "hci0");
+        CHECK(pick({THREE[1]}, {}) == "hci1");
+    }
+
+    void test_pick_empty()
+    {
+        CHECK(pick({}, {}) == "none");
+    }
+
+    void test_find()
+    {
+        const fake_source source {THREE, {}};
+        adapter_t adapter {};
+        CHECK(common::find_adapter(source, "hci2", &adapter) == 0);
+        CHECK(adapter.dev_id == 2);
+        CHECK(adapter.name == "hci2");
+        CHECK(common::find_adapter(source, "hci", &adapter) == -1);
+        CHECK(common::find_adapter(source, "hci3", &adapter) == -1);
+        CHECK(common::find_adapter(source, "", &adapter) == -1);
+        CHECK(adapter.dev_id == 2);
+        CHECK(common::find_adapter(fake_source {{}, {}}, "hci0", &adapter) == -1);
+    }
+
+    // With nothing listed, the socket is left for the kernel to route,
+    // unless a named adapter was asked for
+    void test_bind_empty()
+    {
+        const fake_source source {{}, {}};
+        int dev_id {7};
+        CHECK(common::bind_adapter(-1, source, NULL, &dev_id) == 0);
+        CHECK(dev_id == -1);
+        dev_id = 7;
+        CHECK(common::bind_adapter(-1, source, "hci0", &dev_id) == -1);
+        CHECK(dev_id == -1);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test_pick_least_loaded();
+    test_pick_tie();
+    test_pick_unknown_load();
+    test_pick_empty();
+    test_find();
+    test_bind_empty();
+    return test::report("test_adapter");
+}
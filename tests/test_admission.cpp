@@ -0,0 +1,210 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include "test.h"
+
+namespace {
+    using std::string;
+    namespace fs = std::filesystem;
+
+    common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 1000, 2};
+    common::thread_pool disk {2};
+
+    // Return the response admit_upload() wrote for FILESIZE bytes, or
+    // "admitted" if it wrote none
+    string admit(size_t filesize)
+    {
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        const int status {common::admit_upload(sv[1], filesize, options, disk)};
+        close(sv[1]);
+        auto headers {common::parse_headers(common::read_headers(sv[0]))};
+        close(sv[0]);
+        if (status == 0)
+            return headers.empty() ? "admitted" : "admitted with a response";
+        string res {headers["status"]};
+        if (headers.count("retry-after"))
+            res += " retry-after:" + headers["retry-after"];
+        return res;
+    }
+
+    size_t free_space()
+    {
+        struct statvfs sv {};
+        statvfs(".", &sv);
+        return sv.f_bavail * sv.f_frsize;
+    }
+
+    void test_empty()
+    {
+        CHECK(admit(0) == "400");
+    }
+
+    void test_per_file_cap()
+    {
+        options.max_file = 10;
+        CHECK(admit(11) == "413");
+        CHECK(admit(10) == "admitted");
+        common::release_upload(10);
+        options.max_file = 0;
+    }
+
+    void test_no_space()
+    {
+        CHECK(admit(free_space() * 2) == "507");
+    }
+
+    // Uploads in flight share the budget, but one upload on its own is let
+    // in even if it is bigger than the whole budget
+    void test_budget()
+    {
+        CHECK(admit(600) == "admitted");
+        CHECK(admit(600) == "503 retry-after:5");
+        CHECK(admit(400) == "admitted");
+        common::release_upload(400);
+        common::release_upload(600);
+
+        CHECK(admit(5000) == "admitted");
+        CHECK(admit(1) == "503 retry-after:5");
+        common::release_upload(5000);
+    }
+
+    // Free space already promised to uploads in flight is not free
+    void test_reserved_space()
+    {
+        options.budget = SIZE_MAX;
+        const size_t size {free_space() / 5 * 3};
+        CHECK(admit(size) == "admitted");
+        CHECK(admit(size) == "503 retry-after:5");
+        common::release_upload(size);
+        options.budget = 1000;
+    }
+
+    // The client must send exactly content-length bytes, and the upload's
+    // share of the budget is given back either way
+    void test_content_length()
+    {
+        auto res {test::rpc(test::put_request("zero", 0), "abc", options, disk)};
+        CHECK(res.headers.at("status") == "400");
+        CHECK(!fs::exists("transfer/zero"));
+
+        res = test::rpc(test::put_request("over", 10), string(5000, 'x'), options, disk);
+        CHECK(res.headers.at("status") == "200");
+        CHECK(!fs::exists("transfer/over"));
+
+        res = test::rpc(test::put_request("short", 100), string(50, 'x'), options, disk);
+        CHECK(res.headers.at("status") == "200");
+        CHECK(!fs::exists("transfer/short"));
+
+        res = test::rpc(test::put_request("exact", 10), string(10, 'x'), options, disk);
+        CHECK(res.headers.at("status") == "200");
+        CHECK(fs::file_size("transfer/exact") == 10);
+
+        CHECK(admit(1000) == "admitted");
+        common::release_upload(1000);
+    }
+
+    long max_rss_kib()
+    {
+        struct rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Many clients at once: those over the budget must be turned away before
+    // they send anything, quickly, and without the server holding their data
+    void test_overload()
+    {
+        const size_t clients {64};
+        const size_t size {4 * 1024 * 1024};
+        const string content(size, 'x');
+        options.budget = 16 * 1024 * 1024;
+        common::thread_pool pool {clients};
+        const long rss_before {max_rss_kib()};
+
+        std::vector<double> rejected;
+        std::atomic<size_t> admitted {};
+        std::mutex mutex;
+        std::vector<std::thread> threads;
+        for (size_t i {}; i < clients; i++) {
+            threads.emplace_back([&, i] {
+                const auto start {test::clock::now()};
+                const auto& res {test::rpc(test::put_request("load." + std::to_string(i), size),
+                    content, options, pool)};
+                const double seconds {test::seconds_since(start)};
+                if (res.headers.count("status") && res.headers.at("status") == "503") {
+                    CHECK(res.bytes_sent < 1000);
+                    std::lock_guard lock {mutex};
+                    rejected.push_back(seconds);
+                }
+                else {
+                    admitted++;
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        const long rss_growth {max_rss_kib() - rss_before};
+
+        std::sort(rejected.begin(), rejected.end());
+        const auto percentile {[&](double p) {
+            return rejected.empty() ? 0 : rejected[(rejected.size() - 1) * p];
+        }};
+        fprintf(test::out, "overload: %zu clients of %zu bytes, budget %zu: %zu admitted, %zu rejected\n",
+            clients, size, options.budget, admitted.load(), rejected.size());
+        fprintf(test::out, "overload: rejection latency p50 %.1f ms, p99 %.1f ms; peak RSS grew %ld KiB\n",
+            percentile(0.5) * 1e3, percentile(0.99) * 1e3, rss_growth);
+
+        CHECK(admitted + rejected.size() == clients);
+        CHECK(admitted >= 4);
+        CHECK(percentile(0.99) < 1.0);
+        CHECK(size_t(rss_growth) * 1024 < clients * size / 2);
+        options.budget = 1000;
+    }
+
+    // Clients retry what they were turned away for, and nothing else
+    void test_retry()
+    {
+        CHECK(common::retry_after({{"status", "503"}, {"retry-after", "5"}}) == 5);
+        CHECK(common::retry_after({{"status", "503"}, {"retry-after", "0"}}) == 1);
+        CHECK(common::retry_after({{"status", "404"}}) == 0);
+        CHECK(common::retry_after({{"status", "503"}, {"retry-after", "soon"}}) == 0);
+
+        int calls {};
+        CHECK(common::retry_busy([&](int *retry_after) {
+            calls++;
+            *retry_after = 0;
+            return -1;
+        }) == -1);
+        CHECK(calls == 1);
+
+        calls = 0;
+        const auto start {test::clock::now()};
+        CHECK(common::retry_busy([&](int *retry_after) {
+            *retry_after = 1;
+            return ++calls < 2 ? -1 : 0;
+        }) == 0);
+        CHECK(calls == 2);
+        CHECK(test::seconds_since(start) >= 1.0);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_empty();
+    test_per_file_cap();
+    test_no_space();
+    test_budget();
+    test_reserved_space();
+    test_content_length();
+    test_overload();
+    test_retry();
+    return test::report("test_admission");
+}
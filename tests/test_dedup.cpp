@@ -0,0 +1,179 @@
+#define __cplusplus 201703L
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include "sha256.h"
+#include "test.h"
+
+namespace {
+    using std::string;
+    namespace fs = std::filesystem;
+
+    const fs::path BLOB_DIR {"transfer/.blobs"};
+
+    string make_content(size_t size, int seed)
+    {
+        string content(size, '\0');
+        for (size_t i {}; i < size; i++)
+            content[i] = char(i * 7 + seed);
+        return content;
+    }
+
+    string digest(const string& content)
+    {
+        common::sha256 hash;
+        hash.update(content.data(), content.size());
+        return hash.hexdigest();
+    }
+
+    // Return the number of links to PATHNAME, or 0 if it does not exist
+    nlink_t links(const fs::path& pathname)
+    {
+        struct stat st {};
+        return stat(pathname.c_str(), &st) == 0 ? st.st_nlink : 0;
+    }
+
+    size_t count_blobs()
+    {
+        size_t n {};
+        for (const auto& entry : fs::directory_iterator {BLOB_DIR}) {
+            (void) entry;
+            n++;
+        }
+        return n;
+    }
+
+    common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 64 * 1024 * 1024, 2};
+    common::thread_pool disk {2};
+
+    // Unknown content is received, stored as a blob and linked
+    void test_miss()
+    {
+        const string content {make_content(300000, 1)};
+        const string d {digest(content)};
+        const auto& res {test::rpc(test::put_request("a.bin", content.size(), d), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(res.bytes_sent > content.size());
+        CHECK(links(BLOB_DIR / d) == 2);
+        CHECK(fs::equivalent("transfer/a.bin", BLOB_DIR / d));
+        CHECK(common::sha256_file("transfer/a.bin") == d);
+    }
+
+    // Known content is linked without the client sending any of it
+    void test_hit()
+    {
+        const string content {make_content(300000, 1)};
+        const string d {digest(content)};
+        const auto& res {test::rpc(test::put_request("b.bin", content.size(), d), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "208");
+        CHECK(res.bytes_sent < 1000);
+        CHECK(links(BLOB_DIR / d) == 3);
+        CHECK(fs::equivalent("transfer/b.bin", BLOB_DIR / d));
+    }
+
+    // Sending a name again with the content it already has sends no data,
+    // and the blob goes once the name is replaced without a digest
+    void test_same_name()
+    {
+        const string content {make_content(200000, 6)};
+        const string d {digest(content)};
+        test::rpc(test::put_request("f.bin", content.size(), d), content, options, disk);
+        CHECK(links(BLOB_DIR / d) == 2);
+        const auto& res {test::rpc(test::put_request("f.bin", content.size(), d), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "208");
+        CHECK(res.bytes_sent < 1000);
+        CHECK(links(BLOB_DIR / d) == 2);
+        CHECK(fs::equivalent("transfer/f.bin", BLOB_DIR / d));
+
+        test::rpc(test::put_request("f.bin", content.size()), content, options, disk);
+        CHECK(!fs::exists(BLOB_DIR / d));
+        CHECK(common::sha256_file("transfer/f.bin") == d);
+    }
+
+    // Data that does not hash to the advertised digest never enters the store
+    void test_digest_mismatch()
+    {
+        const string content {make_content(1000, 2)};
+        const string wrong {digest(make_content(1000, 3))};
+        const auto& res {test::rpc(test::put_request("c.bin", content.size(), wrong), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(!fs::exists("transfer/c.bin"));
+        CHECK(!fs::exists(BLOB_DIR / wrong));
+    }
+
+    // A known digest with the wrong size is not linked, and the upload that
+    // follows does not match the digest either
+    void test_size_mismatch()
+    {
+        const string stored {make_content(300000, 1)};
+        const string content {make_content(1000, 1)};
+        const string d {digest(stored)};
+        const auto& res {test::rpc(test::put_request("d.bin", content.size(), d), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(!fs::exists("transfer/d.bin"));
+        CHECK(fs::file_size(BLOB_DIR / d) == stored.size());
+        CHECK(common::sha256_file((BLOB_DIR / d).c_str()) == d);
+    }
+
+    void test_invalid_digest()
+    {
+        const auto& res {test::rpc(test::put_request("e.bin", 10, "not-a-digest"), string(10, 'x'),
+            options, disk)};
+        CHECK(res.headers.at("status") == "400");
+        CHECK(!fs::exists("transfer/e.bin"));
+    }
+
+    // Uploads without a digest are written straight to their name, and
+    // never through a link to a shared blob
+    void test_no_digest()
+    {
+        const string content {make_content(5000, 4)};
+        const string d {digest(make_content(300000, 1))};
+        const auto& res {test::rpc(test::put_request("b.bin", content.size()), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(common::sha256_file("transfer/b.bin") == digest(content));
+        CHECK(links("transfer/b.bin") == 1);
+        CHECK(links(BLOB_DIR / d) == 2);
+        CHECK(common::sha256_file((BLOB_DIR / d).c_str()) == d);
+    }
+
+    // A blob goes once the last name linking to it is replaced, and
+    // temporary files are cleared out at startup
+    void test_garbage_collection()
+    {
+        const string content {make_content(100, 5)};
+        const string d {digest(make_content(300000, 1))};
+        CHECK(fs::exists(BLOB_DIR / d));
+        test::rpc(test::put_request("a.bin", content.size(), digest(content)), content,
+            options, disk);
+        CHECK(!fs::exists(BLOB_DIR / d));
+        CHECK(count_blobs() == 1);
+
+        fs::path incoming {BLOB_DIR / "incoming.abcdef"};
+        std::ofstream {incoming} << "partial";
+        CHECK(common::init_store() == 0);
+        CHECK(!fs::exists(incoming));
+        CHECK(count_blobs() == 1);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_miss();
+    test_hit();
+    test_same_name();
+    test_digest_mismatch();
+    test_size_mismatch();
+    test_invalid_digest();
+    test_no_digest();
+    test_garbage_collection();
+    return test::report("test_dedup");
+}
@@ -0,0 +1,222 @@
+#define __cplusplus 201703L
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "dir_index.h"
+#include "test.h"
+
+namespace {
+    using std::string;
+    namespace fs = std::filesystem;
+
+    constexpr int64_t ALL {std::numeric_limits<int64_t>::min()};
+    const int64_t NOW {time(NULL)};
+
+    void write_file(const string& pathname, size_t size)
+    {
+        std::ofstream {pathname} << string(size, 'x');
+    }
+
+    void set_mtime(const string& pathname, int64_t mtime)
+    {
+        const struct timespec times[2] {{0, UTIME_OMIT}, {mtime, 0}};
+        utimensat(AT_FDCWD, pathname.c_str(), times, 0);
+    }
+
+    // Return the names listed from SINCE on, oldest first, separated by spaces
+    string in_order(common::dir_index& index, int64_t since = ALL)
+    {
+        string result;
+        for (const auto& e : index.list(since))
+            result += (result.empty() ? "" : " ") + e.name;
+        return result;
+    }
+
+    // Return the names listed, sorted, for files whose mtimes may tie
+    string names(common::dir_index& index)
+    {
+        std::set<string> sorted;
+        for (const auto& e : index.list(ALL))
+            sorted.insert(e.name);
+        string result;
+        for (const auto& name : sorted)
+            result += (result.empty() ? "" : " ") + name;
+        return result;
+    }
+
+    // Return the size listed for NAME, or -1 if it is not listed
+    int64_t size_of(common::dir_index& index, const string& name)
+    {
+        for (const auto& e : index.list(ALL)) {
+            if (e.name == name)
+                return e.size;
+        }
+        return -1;
+    }
+
+    // Only regular files with names that fit on a listing line are listed
+    void test_filter()
+    {
+        fs::create_directory("filter");
+        write_file("filter/plain", 1);
+        write_file("filter/.hidden", 1);
+        write_file("filter/tab\there", 1);
+        write_file("filter/new\nline", 1);
+        fs::create_directory("filter/subdir");
+        mkfifo("filter/fifo", 0644);
+        common::dir_index index {"filter"};
+        CHECK(names(index) == "plain");
+    }
+
+    // Entries are ordered by mtime, and SINCE leaves out those that are older
+    void test_since()
+    {
+        fs::create_directory("since");
+        for (const char *name : {"c", "a", "b"})
+            write_file("since/" + string {name}, 1);
+        set_mtime("since/a", NOW + 100);
+        set_mtime("since/b", NOW + 200);
+        set_mtime("since/c", NOW + 300);
+        common::dir_index index {"since"};
+        CHECK(in_order(index) == "a b c");
+        CHECK(in_order(index, NOW + 100) == "a b c");
+        CHECK(in_order(index, NOW + 101) == "b c");
+        CHECK(in_order(index, NOW + 150) == "b c");
+        CHECK(in_order(index, NOW + 299) == "c");
+        CHECK(in_order(index, NOW + 300) == "c");
+        CHECK(in_order(index, NOW + 301) == "");
+        CHECK(in_order(index, NOW - 10) == "a b c");
+    }
+
+    // A name newly linked to old contents is listed by the time it was
+    // linked, not by the timestamps it shares with the contents, and linking
+    // it does not move the other names of those contents
+    void test_linked_name()
+    {
+        fs::create_directory("linked");
+        write_file("linked/old", 1);
+        set_mtime("linked/old", NOW - 1000);
+        common::dir_index index {"linked"};
+        CHECK(in_order(index) == "old");
+        fs::create_hard_link("linked/old", "linked/new");
+        index.update("new");
+        CHECK(in_order(index, NOW - 10) == "new");
+        CHECK(in_order(index) == "old new");
+
+        // A name found on disk is listed by its mtime, however recently
+        // another name was linked to the same file
+        common::dir_index later {"linked"};
+        CHECK(in_order(later, NOW - 10) == "");
+    }
+
+    // Changes to the directory are picked up on the next listing, but only
+    // new or replaced names are statted again
+    void test_refresh()
+    {
+        fs::create_directory("refresh");
+        write_file("refresh/a", 1);
+        write_file("refresh/b", 2);
+        write_file("refresh/c", 3);
+        common::dir_index index {"refresh"};
+        CHECK(names(index) == "a b c");
+
+        // Straight after a listing, in the same timestamp tick
+        write_file("refresh/d", 4);
+        CHECK(names(index) == "a b c d");
+        fs::remove("refresh/a");
+        CHECK(names(index) == "b c d");
+        fs::rename("refresh/b", "refresh/e");
+        CHECK(names(index) == "c d e");
+
+        // Replacing a name gives it a new inode, which is statted
+        write_file("refresh/new", 40);
+        fs::rename("refresh/new", "refresh/d");
+        CHECK(size_of(index, "d") == 40);
+
+        // Rewriting a file in place does not touch the directory, so the
+        // old size stays listed until update() even if the directory is reread
+        set_mtime("refresh", NOW - 100);
+        CHECK(size_of(index, "c") == 3);
+        write_file("refresh/c", 30);
+        CHECK(size_of(index, "c") == 3);
+        write_file("refresh/f", 5);
+        CHECK(size_of(index, "f") == 5);
+        CHECK(size_of(index, "c") == 3);
+        index.update("c");
+        CHECK(size_of(index, "c") == 30);
+    }
+
+    // update() adds new names, drops removed ones, and ignores what cannot
+    // be listed
+    void test_update()
+    {
+        fs::create_directory("update");
+        common::dir_index index {"update"};
+        CHECK(names(index) == "");
+        write_file("update/a", 1);
+        index.update("a");
+        CHECK(names(index) == "a");
+        fs::remove("update/a");
+        index.update("a");
+        index.update("missing");
+        index.update(".hidden");
+        CHECK(names(index) == "");
+    }
+
+    // LIST answers from the server's index of "transfer"
+    void test_list_request()
+    {
+        const common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 1000, 1};
+        common::thread_pool disk {1};
+        write_file("transfer/one", 10);
+        write_file("transfer/two", 20);
+        set_mtime("transfer/two", NOW + 100);
+
+        auto res {test::rpc("method:LIST\n\n", "", options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(res.body.rfind("transfer/one\t10\t", 0) == 0);
+        CHECK(res.body.find("\ntransfer/two\t20\t" + std::to_string(NOW + 100) + '\n')
+            != string::npos);
+
+        res = test::rpc("method:LIST\nif-modified-since:" + std::to_string(NOW + 50) + "\n\n", "",
+            options, disk);
+        CHECK(res.body == "transfer/two\t20\t" + std::to_string(NOW + 100) + '\n');
+    }
+
+    // Sending back the date of one listing as if-modified-since lists what
+    // changed after it, even within the same second
+    void test_list_date()
+    {
+        const common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 1000, 1};
+        common::thread_pool disk {1};
+        write_file("transfer/three", 30);
+        set_mtime("transfer/three", NOW - 100);
+
+        auto res {test::rpc("method:LIST\n\n", "", options, disk)};
+        const string date {res.headers["date"]};
+        CHECK(!date.empty());
+        write_file("transfer/four", 40);
+        res = test::rpc("method:LIST\nif-modified-since:" + date + "\n\n", "", options, disk);
+        CHECK(res.body.find("transfer/four\t40\t") != string::npos);
+        CHECK(res.body.find("transfer/three") == string::npos);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_filter();
+    test_since();
+    test_linked_name();
+    test_refresh();
+    test_update();
+    test_list_request();
+    test_list_date();
+    return test::report("test_dir_index");
+}
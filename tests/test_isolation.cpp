@@ -0,0 +1,128 @@
+#define __cplusplus 201703L
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "test.h"
+
+// A slow disk is stood in for by FIFOs: a GET of one blocks a disk thread
+// in open() until the test writes to it. Other clients must not notice as
+// long as the server serves no more clients than it has disk threads.
+
+namespace {
+    using namespace std::chrono_literals;
+    using std::string;
+
+    const common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 1000, 0};
+
+    string get_request(const string& pathname)
+    {
+        return "method:GET\npathname:" + pathname + "\n\n";
+    }
+
+    struct stalled_t {
+        std::vector<string> fifos;
+        std::vector<std::thread> clients;
+    };
+
+    // Start COUNT clients that each GET a FIFO, and wait until their disk
+    // jobs are stuck
+    stalled_t stall(size_t count, common::thread_pool& disk)
+    {
+        stalled_t stalled;
+        for (size_t i {}; i < count; i++) {
+            const string fifo {"transfer/slow." + std::to_string(i)};
+            mkfifo(fifo.c_str(), 0644);
+            stalled.fifos.push_back(fifo);
+            stalled.clients.emplace_back([fifo, &disk] {
+                const auto& res {test::rpc(get_request(fifo), "", options, disk)};
+                CHECK(res.headers.at("status") == "404");
+            });
+        }
+        std::this_thread::sleep_for(100ms);
+        return stalled;
+    }
+
+    // Let the stalled clients finish
+    void release(stalled_t& stalled)
+    {
+        for (const auto& fifo : stalled.fifos)
+            close(open(fifo.c_str(), O_WRONLY));
+        for (auto& t : stalled.clients)
+            t.join();
+    }
+
+    // Return the latencies of COUNT GETs of a small file, in seconds, sorted
+    std::vector<double> time_gets(size_t count, common::thread_pool& disk)
+    {
+        std::vector<double> latencies;
+        for (size_t i {}; i < count; i++) {
+            const auto start {test::clock::now()};
+            const auto& res {test::rpc(get_request("transfer/small"), "", options, disk)};
+            latencies.push_back(test::seconds_since(start));
+            CHECK(res.headers.at("status") == "200");
+            CHECK(res.body.size() == 64 * 1024);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+
+    void print_latencies(const char *label, const std::vector<double>& latencies)
+    {
+        fprintf(test::out, "%s: p50 %.2f ms, p99 %.2f ms, max %.2f ms over %zu GETs\n", label,
+            latencies[latencies.size() / 2] * 1e3, latencies[(latencies.size() - 1) * 99 / 100] * 1e3,
+            latencies.back() * 1e3, latencies.size());
+    }
+
+    // Within the cap, every other client keeps a disk thread to itself
+    void test_within_cap()
+    {
+        const size_t threads {4};
+        common::thread_pool disk {threads};
+        print_latencies("idle server", time_gets(200, disk));
+
+        stalled_t stalled {stall(1, disk)};
+        std::vector<std::vector<double>> latencies(threads - 1);
+        std::vector<std::thread> clients;
+        for (auto& l : latencies)
+            clients.emplace_back([&l, &disk] { l = time_gets(200, disk); });
+        for (auto& t : clients)
+            t.join();
+        release(stalled);
+
+        for (size_t i {}; i < latencies.size(); i++) {
+            const string label {"client " + std::to_string(i + 1) + ", 1 of 4 disk threads stalled"};
+            print_latencies(label.c_str(), latencies[i]);
+            CHECK(latencies[i].back() < 0.5);
+        }
+    }
+
+    // Over the cap, the next client queues behind the stalled one. This is
+    // what the server avoids by turning such clients away.
+    void test_over_cap()
+    {
+        common::thread_pool disk {1};
+        stalled_t stalled {stall(1, disk)};
+        std::thread releaser {[&] {
+            std::this_thread::sleep_for(300ms);
+            release(stalled);
+        }};
+        const auto& latencies {time_gets(1, disk)};
+        releaser.join();
+
+        print_latencies("1 of 1 disk threads stalled", latencies);
+        CHECK(latencies.back() >= 0.2);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    std::ofstream {"transfer/small"} << string(64 * 1024, 'x');
+    test_within_cap();
+    test_over_cap();
+    return test::report("test_isolation");
+}
@@ -0,0 +1,63 @@
+#define __cplusplus 201703L
+#include <fstream>
+#include <string>
+#include "sha256.h"
+#include "test.h"
+
+namespace {
+    using std::string;
+
+    string digest(const string& message)
+    {
+        common::sha256 hash;
+        hash.update(message.data(), message.size());
+        return hash.hexdigest();
+    }
+
+    // Test vectors from FIPS 180-2, appendix B
+    void test_fips_vectors()
+    {
+        CHECK(digest("abc")
+            == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK(digest("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")
+            == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+        CHECK(digest(string(1000000, 'a'))
+            == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+        CHECK(digest("")
+            == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    }
+
+    // Feeding a message in pieces that straddle block boundaries must give
+    // the same digest as feeding it in one go
+    void test_streaming()
+    {
+        string message(1000, '\0');
+        for (size_t i {}; i < message.size(); i++)
+            message[i] = char(i * 31 + 7);
+        const string expected {digest(message)};
+
+        for (size_t piece : {1, 3, 55, 56, 63, 64, 65, 999}) {
+            common::sha256 hash;
+            for (size_t i {}; i < message.size(); i += piece)
+                hash.update(message.data() + i, std::min(piece, message.size() - i));
+            CHECK(hash.hexdigest() == expected);
+        }
+    }
+
+    void test_file()
+    {
+        const string message(100000, 'x');
+        std::ofstream {"message"} << message;
+        CHECK(common::sha256_file("message") == digest(message));
+        CHECK(common::sha256_file("no-such-file").empty());
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_fips_vectors();
+    test_streaming();
+    test_file();
+    return test::report("test_sha256");
+}
@@ -0,0 +1,46 @@
+#define __cplusplus 201703L
+#include <vector>
+#include "test.h"
+#include "thread_pool.h"
+
+namespace {
+    // Every submitted job runs, and its result reaches the caller
+    void test_results()
+    {
+        common::thread_pool pool {4};
+        CHECK(pool.size() == 4);
+        std::vector<std::future<int>> futures;
+        for (int i {}; i < 1000; i++)
+            futures.push_back(pool.submit([i] { return i * i; }));
+        long sum {};
+        for (auto& f : futures)
+            sum += f.get();
+        CHECK(sum == 332833500);
+    }
+
+    // A job may submit to another, smaller pool, whose queues must not be
+    // picked by the index the worker has in its own pool
+    void test_nested()
+    {
+        common::thread_pool big {4};
+        common::thread_pool small {1};
+        std::vector<std::future<int>> futures;
+        for (int i {}; i < 100; i++) {
+            futures.push_back(big.submit([&, i] {
+                return small.submit([i] { return 2 * i; }).get();
+            }));
+        }
+        long sum {};
+        for (auto& f : futures)
+            sum += f.get();
+        CHECK(sum == 9900);
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_results();
+    test_nested();
+    return test::report("test_thread_pool");
+}
@@ -0,0 +1,126 @@
+#define __cplusplus 201703L
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "test.h"
+
+namespace {
+    using std::string;
+    namespace fs = std::filesystem;
+
+    string make_content(size_t size, int seed)
+    {
+        string content(size, '\0');
+        for (size_t i {}; i < size; i++)
+            content[i] = char(i * 7 + seed);
+        return content;
+    }
+
+    string read_file(const fs::path& pathname)
+    {
+        std::ifstream ifs {pathname, std::ios::binary};
+        std::ostringstream oss;
+        oss << ifs.rdbuf();
+        return oss.str();
+    }
+
+    common::server_options options {0, common::DEFAULT_TUNER_BOUNDS, 0, 64 * 1024 * 1024, 2};
+    common::thread_pool disk {2};
+
+    // An upload lands in "transfer" under the last component of its pathname
+    void test_put()
+    {
+        const string content {make_content(100000, 1)};
+        const auto& res {test::rpc(test::put_request("../a.bin", content.size()), content,
+            options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(read_file("transfer/a.bin") == content);
+        CHECK(!fs::exists("a.bin"));
+    }
+
+    // A download carries content-length and exactly that many bytes
+    void test_get()
+    {
+        const string content {make_content(100000, 1)};
+        const auto& res {test::rpc("method:GET\npathname:transfer/a.bin\n\n", "", options, disk)};
+        CHECK(res.headers.at("status") == "200");
+        CHECK(res.headers.at("content-length") == std::to_string(content.size()));
+        CHECK(res.body == content);
+    }
+
+    // A file that grows while a batch is being sent is cut at the size it
+    // was announced with, so the next file's headers follow straight after
+    void test_get_growing()
+    {
+        const string content {make_content(4 * 1024 * 1024, 2)};
+        std::ofstream {"transfer/big", std::ios::binary} << content;
+        std::ofstream {"transfer/small"} << "small";
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            exit(EXIT_FAILURE);
+        }
+        std::thread server {[&] { common::serve_client(sv[1], sockaddr_rc {}, -1, options, disk); }};
+        const string body {"transfer/big\ntransfer/small\n"};
+        const string request {"method:GET\ncontent-length:" + std::to_string(body.size()) + "\n\n"
+            + body};
+        common::write_bytes(sv[0], request.data(), request.size());
+        auto headers {common::parse_headers(common::read_headers(sv[0]))};
+        CHECK(headers["count"] == "2");
+        headers = common::parse_headers(common::read_headers(sv[0]));
+        CHECK(headers["content-length"] == std::to_string(content.size()));
+
+        // The socket buffer holds far less than the file, so the server is
+        // still sending it
+        std::ofstream {"transfer/big", std::ios::binary | std::ios::app} << "grown";
+        string data(content.size(), '\0');
+        CHECK(common::read_bytes(sv[0], data.data(), data.size()) == 0);
+        CHECK(data == content);
+        headers = common::parse_headers(common::read_headers(sv[0]));
+        CHECK(headers["pathname"] == "transfer/small");
+        CHECK(headers["content-length"] == "5");
+
+        shutdown(sv[0], SHUT_WR);
+        char buf[64];
+        while (read(sv[0], buf, sizeof(buf)) > 0)
+            ;
+        server.join();
+        close(sv[0]);
+    }
+
+    // Only non-empty regular files can be downloaded
+    void test_get_missing()
+    {
+        std::ofstream {"transfer/empty"};
+        for (const string pathname : {"transfer/missing", "transfer/empty", "transfer"}) {
+            const auto& res {test::rpc("method:GET\npathname:" + pathname + "\n\n", "",
+                options, disk)};
+            CHECK(res.headers.at("status") == "404");
+            CHECK(res.body.empty());
+        }
+    }
+
+    // A request the server cannot make sense of is dropped without an answer
+    void test_bad_request()
+    {
+        for (const string request : {"method:MOVE\npathname:transfer/a.bin\n\n",
+                "method:PUT\npathname:b.bin\n\n", "method:GET\n\n"}) {
+            const auto& res {test::rpc(request, "", options, disk)};
+            CHECK(res.headers.at("status").empty());
+        }
+        CHECK(!fs::exists("transfer/b.bin"));
+    }
+} // unnamed namespace
+
+int main()
+{
+    test::enter_scratch_dir();
+    test_put();
+    test_get();
+    test_get_growing();
+    test_get_missing();
+    test_bad_request();
+    return test::report("test_transfer");
+}